@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Checks that the results do not depend on how the scan is run.
+
+Builds the engine for every SIMD tier the host runs, and once with
+USE_WIDE_VALUES. On a generated file it then checks that the output, the
+--checksum line included, is byte-identical across tiers, --cursors 1-4,
+--threads counts and repeated runs. --threads can exceed the CPUs, so the
+multi-threaded paths run even on a single-core machine. Exact results are
+checked with --locate-extremes and --outliers, whose values have many ties,
+and sampled results with a fixed --seed.
+
+It also checks that sums past the range of Value are reported. A wrapping
+int64 sum takes billions of spec rows, so the wide build is given a
+hundred rows of large values instead. A value past the range of a narrow
+build fails the row as malformed.
+
+The compiler is $CXX (default c++) with $CXXFLAGS added.
+
+Usage: check_determinism.py [rows] [seed]
+"""
+
+import os
+import random
+import shlex
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+TIERS = {
+    "USE_AVX512": ["-mavx512f", "-mavx512bw"],
+    "USE_AVX2": ["-mavx2"],
+    "USE_SSE2": ["-msse2"],
+    "USE_NAIVE": [],
+}
+CURSORS = [1, 2, 3, 4]
+THREADS = [1, 2, 8]
+REPEATS = 3
+MODES = {
+    "exact": ["--checksum", "--locate-extremes", "--outliers", "2"],
+    "sampled": ["--sample", "0.3", "--seed", "7"],
+}
+
+failures = []
+
+
+def check(ok, what):
+    print(("ok      " if ok else "FAILED  ") + what)
+    if not ok:
+        failures.append(what)
+
+
+def build(directory, name, defines, flags):
+    output = os.path.join(directory, name)
+    command = (
+        [os.environ.get("CXX", "c++"), "-std=c++23", "-O2"]
+        + flags
+        + shlex.split(os.environ.get("CXXFLAGS", ""))
+        + [f"-D{define}" for define in defines]
+        + [os.path.join(ROOT, "src", "main.cc"), "-o", output]
+    )
+    # The parallel algorithms of libstdc++ need TBB when it is installed
+    for libraries in (["-ltbb"], []):
+        if subprocess.run(command + libraries, capture_output=True).returncode == 0:
+            return output
+    return None
+
+
+def run(binary, args):
+    return subprocess.run([binary] + args, capture_output=True, text=True)
+
+
+def write_measurements(path, rows, rng):
+    names = [f"Station {i}" for i in range(400)]
+    # Short rows take the scalar path instead of the batched parse
+    names += ["A", "B", "C"]
+    with open(path, "w", encoding="utf-8") as out:
+        for _ in range(rows):
+            name = rng.choice(names)
+            value = rng.randint(-999, 999) / 10
+            if len(name) == 1:
+                value = rng.randint(-9, 9)
+            out.write(f"{name};{value:.1f}\n")
+
+
+def check_outputs(binaries, path):
+    for mode, args in MODES.items():
+        reference = None
+        for tier, binary in binaries.items():
+            for cursors in CURSORS:
+                for threads in THREADS:
+                    for _ in range(REPEATS if threads > 1 else 1):
+                        result = run(
+                            binary,
+                            args
+                            + ["--cursors", str(cursors), "--threads", str(threads)]
+                            + [path],
+                        )
+                        if result.returncode != 0:
+                            check(False, f"{mode} {tier}: {result.stderr.strip()}")
+                            return
+                        if reference is None:
+                            reference = result.stdout
+                        if result.stdout != reference:
+                            check(
+                                False,
+                                f"{mode} output of {tier} with --cursors "
+                                f"{cursors} --threads {threads}",
+                            )
+                            return
+        check(True, f"{mode} output identical across {', '.join(binaries)}")
+
+
+def check_overflow(narrow, wide, directory):
+    # The largest rows are spread over many chunks so that their adds race
+    value = 10**17
+    rows = (2**63 - 1) // value
+    path = os.path.join(directory, "sum.txt")
+    for count, overflows in ((rows, False), (rows + 1, True)):
+        with open(path, "w", encoding="utf-8") as out:
+            for _ in range(count):
+                out.write(f"Hot;{value}\n")
+                out.write("".join(f"Cold {i % 100};1\n" for i in range(10000)))
+        for threads in THREADS:
+            result = run(wide, ["--scale", "0", "--threads", str(threads), path])
+            if overflows:
+                check(
+                    result.returncode != 0
+                    and "sum of values overflowed for Hot" in result.stderr,
+                    f"{count} x {value} reported as overflowing, --threads {threads}",
+                )
+            else:
+                check(
+                    result.returncode == 0 and "Hot=" in result.stdout,
+                    f"{count} x {value} fits, --threads {threads}",
+                )
+
+    with open(path, "w", encoding="utf-8") as out:
+        out.write("Cold;1.0\nHot;99999999999.9\n")
+    result = run(narrow, [path])
+    check(
+        result.returncode != 0 and "Hot;99999999999.9" in result.stderr,
+        "value past the narrow range is malformed",
+    )
+
+
+def main():
+    args = sys.argv[1:]
+    rows = int(args[0]) if len(args) > 0 else 1_000_000
+    rng = random.Random(int(args[1]) if len(args) > 1 else 0)
+
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "measurements.txt")
+        write_measurements(path, rows, rng)
+
+        binaries = {}
+        for tier, flags in TIERS.items():
+            binary = build(directory, tier, [tier], flags)
+            # Tiers the compiler or the CPU lacks are skipped
+            if binary is None or run(binary, [path]).returncode != 0:
+                print(f"skipped {tier}")
+                continue
+            binaries[tier] = binary
+        if not binaries:
+            sys.exit("no tier could be built, check $CXX and $CXXFLAGS")
+        tier = next(iter(binaries))
+        wide = build(directory, "wide", [tier, "USE_WIDE_VALUES"], TIERS[tier])
+        if wide is None:
+            sys.exit("the USE_WIDE_VALUES build failed")
+        binaries["wide " + tier] = wide
+
+        check_outputs(binaries, path)
+        check_overflow(binaries[tier], wide, directory)
+
+    if failures:
+        sys.exit(f"{len(failures)} check(s) failed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Creates a measurements file whose station names are long multi-byte UTF-8
+strings, up to the 100 bytes allowed by the spec, to benchmark the name
+hashing and comparison paths.
+
+With --middle the names share a long prefix and suffix and only differ in
+the middle, which defeats hashes that skip part of the name.
+
+Usage: create_long_name_measurements.py [--middle] <rows> <output>
+           [stations] [seed]
+"""
+
+import random
+import sys
+
+MAX_NAME_BYTES = 100
+
+# Mix of 1- to 4-byte UTF-8 sequences
+ALPHABET = (
+    "abcdefghijklmnopqrstuvwxyz -'"
+    "äöüßéèêëñçøåłżźśćńœ"
+    "αβγδεζηθλμξπστφχψω"
+    "абвгдежзийклмнопрстуфхцчшщыэюя"
+    "東京北京大阪上海香港首爾臺北"
+    "🌍🌧🌡"
+)
+
+
+def station_name(rng):
+    target = rng.randint(MAX_NAME_BYTES // 2, MAX_NAME_BYTES)
+    name = ""
+    while True:
+        char = rng.choice(ALPHABET)
+        if len((name + char).encode()) > target:
+            break
+        name += char
+    # A name may not start or end with a space
+    return name.strip() or "x"
+
+
+def middle_name(rng, prefix, suffix):
+    return f"{prefix} {rng.randrange(10**6):06d} {suffix}"
+
+
+def main():
+    args = sys.argv[1:]
+    middle = "--middle" in args
+    if middle:
+        args.remove("--middle")
+    if len(args) < 2:
+        sys.exit(__doc__)
+    rows = int(args[0])
+    output = args[1]
+    stations = int(args[2]) if len(args) > 2 else 10000
+    rng = random.Random(int(args[3]) if len(args) > 3 else 0)
+
+    names = set()
+    if middle:
+        # Both affixes are longer than the 16-byte blocks names are hashed in
+        prefix = "Weather station number"
+        suffix = "in the northern region of the country"
+        if stations > 10**6:
+            sys.exit("--middle supports up to 1000000 stations")
+        while len(names) < stations:
+            names.add(middle_name(rng, prefix, suffix))
+    while len(names) < stations:
+        names.add(station_name(rng))
+    names = sorted(names)
+
+    with open(output, "w", encoding="utf-8") as out:
+        for _ in range(rows):
+            out.write(f"{rng.choice(names)};{rng.randint(-999, 999) / 10:.1f}\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,30 +1,93 @@
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <charconv>
+#include <concepts>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <execution>
 #include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <limits>
-#include <print>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if __has_include(<tbb/global_control.h>) && __has_include(<tbb/task_arena.h>)
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#endif
+
+#if !defined(USE_NAIVE)
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <smmintrin.h>
+#endif
+
 constexpr size_t UNIQUE_NAMES = 10000;
+// 100-byte station name, ';', the value and the line terminator
+constexpr size_t MAX_ROW_LENGTH = 128;
+constexpr size_t CHUNK_SIZE = 1 << 20;
+// Rows whose values are parsed together
+constexpr size_t PARSE_BATCH = 16;
+// Upper bound for the rows scanned in lockstep by one thread
+constexpr size_t MAX_CURSORS = 4;
+// Decimal places of the values. Scales 0 to 2 have their own parse kernels,
+// the others up to MAX_SCALE go through the generic parser, which is what
+// a scale of GENERIC_SCALE selects as a template argument.
+constexpr int MAX_SCALE = 6;
+constexpr int GENERIC_SCALE = -1;
+constexpr std::array<int64_t, MAX_SCALE + 3> POW10 = [] {
+  std::array<int64_t, MAX_SCALE + 3> powers{};
+  for (int64_t i = 0, power = 1; i < static_cast<int64_t>(powers.size());
+       ++i, power *= 10)
+    powers[i] = power;
+  return powers;
+}();
+// Part of the result cache key, bump whenever the output for the same
+// input and options changes
+constexpr int ENGINE_VERSION = 3;
+// Byte offsets listed per kind of problem found in the input
+constexpr size_t MAX_REPORTED = 10;
 
 namespace {
 class MappedFile {
   int fd = -1;
   void *addr = nullptr;
+  size_t mapSize = 0;
   size_t fileSize = 0;
 
+  const char *slice = nullptr;
+  size_t sliceOffset = 0;
+  size_t sliceSize = 0;
+
 public:
   MappedFile() = default;
 
-  explicit MappedFile(const std::string &filename) {
+  // Maps the rows of `filename` that start within [offset, offset + length).
+  // The slice is snapped to newline boundaries so that adjacent slices
+  // partition the file without splitting or repeating a row.
+  explicit MappedFile(const std::string &filename, size_t offset = 0,
+                      size_t length = std::numeric_limits<size_t>::max()) {
     fd = open(filename.c_str(), O_RDONLY);
     if (fd == -1) {
       throw std::runtime_error("Failed to open file");
@@ -37,18 +100,58 @@ public:
       throw std::runtime_error("Failed to get file size");
     }
     fileSize = sb.st_size;
+    offset = std::min(offset, fileSize);
+    length = std::min(length, fileSize - offset);
 
-    // Map the file into memory
-    addr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (addr == MAP_FAILED) {
-      close(fd);
-      throw std::runtime_error("Failed to map the file");
+    // Map the slice plus the byte before it and the rest of the row it
+    // ends in, which are needed to find the row boundaries. Rows of
+    // projected files can be longer than MAX_ROW_LENGTH, so the window
+    // grows until it reaches the newline ending that row.
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t windowBegin = (offset == 0 ? 0 : offset - 1) & ~(pageSize - 1);
+    for (size_t slack = MAX_ROW_LENGTH;; slack *= 2) {
+      const size_t windowEnd = std::min(fileSize, offset + length + slack);
+      mapSize = windowEnd - windowBegin;
+      if (mapSize == 0)
+        return;
+
+      // Map the file into memory
+      addr = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, windowBegin);
+      if (addr == MAP_FAILED) {
+        addr = nullptr;
+        close(fd);
+        throw std::runtime_error("Failed to map the file");
+      }
+
+      const std::string_view window(reinterpret_cast<const char *>(addr),
+                                    mapSize);
+      // Start of the first row at or after `pos`, npos if the window ends
+      // before it
+      auto next_row = [&](size_t pos) {
+        if (pos == 0 || pos == fileSize ||
+            window[pos - windowBegin - 1] == '\n')
+          return pos;
+        size_t newline = window.find('\n', pos - windowBegin);
+        if (newline != std::string_view::npos)
+          return windowBegin + newline + 1;
+        return windowEnd == fileSize ? fileSize : std::string_view::npos;
+      };
+      // The row the slice starts in ends no later than the one it ends in
+      const size_t sliceEnd = next_row(offset + length);
+      if (sliceEnd != std::string_view::npos) {
+        sliceOffset = next_row(offset);
+        sliceSize = std::max(sliceEnd, sliceOffset) - sliceOffset;
+        slice = window.data() + (sliceOffset - windowBegin);
+        return;
+      }
+      munmap(addr, mapSize);
+      addr = nullptr;
     }
   }
 
   ~MappedFile() {
     if (addr)
-      munmap(addr, fileSize);
+      munmap(addr, mapSize);
     if (fd != -1)
       close(fd);
   }
@@ -57,222 +160,3037 @@ public:
   MappedFile &operator=(const MappedFile &) = delete;
 
   MappedFile(MappedFile &&other) noexcept
-      : fd(other.fd), addr(other.addr), fileSize(other.fileSize) {
+      : fd(other.fd), addr(other.addr), mapSize(other.mapSize),
+        fileSize(other.fileSize), slice(other.slice),
+        sliceOffset(other.sliceOffset), sliceSize(other.sliceSize) {
     other.addr = nullptr;
     other.fd = -1;
+    other.mapSize = 0;
     other.fileSize = 0;
+    other.slice = nullptr;
+    other.sliceOffset = 0;
+    other.sliceSize = 0;
   }
 
   MappedFile &operator=(MappedFile &&other) noexcept {
     if (this == &other)
       return *this;
     addr = other.addr;
+    mapSize = other.mapSize;
     fileSize = other.fileSize;
     fd = other.fd;
+    slice = other.slice;
+    sliceOffset = other.sliceOffset;
+    sliceSize = other.sliceSize;
 
     other.addr = nullptr;
+    other.mapSize = 0;
     other.fileSize = 0;
     other.fd = -1;
+    other.slice = nullptr;
+    other.sliceOffset = 0;
+    other.sliceSize = 0;
     return *this;
   }
 
-  [[nodiscard]] const char *data() const & {
-    return reinterpret_cast<const char *>(addr);
-  }
+  [[nodiscard]] const char *data() const & { return slice; }
 
-  [[nodiscard]] size_t size() const & { return fileSize; }
+  [[nodiscard]] size_t size() const & { return sliceSize; }
+
+  // Offset of data() from the beginning of the file
+  [[nodiscard]] size_t offset() const & { return sliceOffset; }
 };
 
-struct StationData {
-  std::atomic<float> min = std::numeric_limits<float>::max();
-  std::atomic<float> max = std::numeric_limits<float>::min();
-  std::atomic<uint> count = 0;
-  std::atomic<float> sum = 0;
+// Narrows `data` to `row_count` rows starting at row `first_row`.
+// Rows before the range still have to be scanned for newlines,
+// but they are not parsed.
+std::string_view select_rows(std::string_view data, size_t first_row,
+                             size_t row_count) {
+  auto skip_rows = [&](size_t pos, size_t rows) {
+    for (; rows > 0 && pos < data.size(); --rows) {
+      size_t newline = data.find('\n', pos);
+      pos = newline == std::string_view::npos ? data.size() : newline + 1;
+    }
+    return pos;
+  };
 
-  std::atomic<int> index = -1;
-  std::string_view name;
-  std::mutex name_mutex;
+  size_t begin = skip_rows(0, first_row);
+  size_t end = row_count == std::numeric_limits<size_t>::max()
+                   ? data.size()
+                   : skip_rows(begin, row_count);
+  return data.substr(begin, end - begin);
+}
 
-  void set_name(const std::string_view &station, const size_t station_index) {
-    // Early check to reduce locking overhead
-    if (index.load(std::memory_order_acquire) != -1)
-      return;
+// What happens to rows that are not a name, ';' and a number
+enum class ErrorPolicy {
+  // Stop the scan and print no results
+  Abort,
+  // Leave the rows out of the results and list the first ones
+  Skip,
+  // Leave the rows out of the results and only count them
+  Count,
+};
 
-    std::lock_guard<std::mutex> lock(name_mutex);
-    // Confirm the condition hasn't changed after acquiring the lock
-    if (index.load(std::memory_order_relaxed) != -1)
-      return;
+// Fields of a delimited file that hold the station name and the value,
+// counted from 0. Files that are not projected follow the spec: the value
+// is what follows the last ';'.
+struct Columns {
+  bool project = false;
+  char delimiter = ';';
+  size_t name = 0;
+  size_t value = 1;
+};
+
+// Whether the first row of the file is a header
+enum class Header { Auto, Yes, No };
+
+// Options of the row scan that stay the same for every chunk
+struct ScanOptions {
+  // Rows scanned in lockstep by each thread
+  size_t cursors = 1;
+  bool validate_utf8 = false;
+  ErrorPolicy on_error = ErrorPolicy::Abort;
+  Columns columns;
+  // Decimal places of the values
+  int scale = 1;
+};
+
+// Key stations are rolled up by: the first `length` characters of their
+// name, their name up to `separator`, or a metadata attribute
+struct RollupKey {
+  enum class Kind { Prefix, Before, Attribute };
+  Kind kind = Kind::Attribute;
+  size_t length = 0;
+  char separator = 0;
+  std::string attribute;
+  // As given on the command line, labels the roll-up
+  std::string spec;
+};
+
+struct Options {
+  std::string path;
+  size_t offset = 0;
+  size_t length = std::numeric_limits<size_t>::max();
+  size_t first_row = 0;
+  size_t row_count = std::numeric_limits<size_t>::max();
+  double sample = 1.0;
+  uint64_t seed = std::random_device{}();
+  // Milliseconds between progressive estimates, 0 disables them
+  size_t progress_interval = 0;
+  // Milliseconds after start to stop scanning at, 0 disables the deadline
+  size_t deadline = 0;
+  std::string cache_dir;
+  // Auto skips a first row whose value does not start like a number
+  Header header = Header::Auto;
+  // Print a fingerprint of the exact results after them
+  bool checksum = false;
+  // Print exact totals in the format diff reads back instead of results
+  bool partial = false;
+  // Compare the aggregates of `path` and `other_path`
+  bool diff = false;
+  std::string other_path;
+  // Smallest change of min, max or mean that diff reports
+  double threshold = 0;
+  // File of station attributes joined to the exact results
+  std::string metadata;
+  // ATTR=VALUE conditions a station has to meet to be printed
+  std::vector<std::pair<std::string, std::string>> where;
+  // Attribute whose values the stations are listed under
+  std::string group_by;
+  // Totals over groups of stations printed after the results, one per key
+  std::vector<RollupKey> rollups;
+  // Print the byte offsets of the rows holding each station's min and max
+  bool locate_extremes = false;
+  // Count readings more than this many standard deviations from their
+  // station's mean in a second pass, 0 disables it
+  double outliers = 0;
+  // Workers of the parallel scan, 0 leaves the number to the runtime
+  size_t threads = 0;
+  ScanOptions scan;
+};
+
+constexpr std::string_view USAGE =
+    "Usage: 1brc [--offset BYTES] [--length BYTES] [--first-row N] "
+    "[--row-count N] [--sample FRACTION] [--seed N] [--progressive MS] "
+    "[--deadline MS] [--cache DIR] [--cursors 1-4] [--validate-utf8] "
+    "[--on-error abort|skip|count] [--header auto|yes|no] "
+    "[--delimiter CHAR] [--columns NAME,VALUE] [--scale 0-6] [--checksum] "
+    "[--partial] [--metadata PATH [--where ATTR=VALUE]... [--group-by ATTR]] "
+    "[--rollup prefix:N|before:CHAR|ATTR]... [--locate-extremes] "
+    "[--outliers K] [--threads N] <path>\n"
+    "       1brc diff [--threshold DELTA] [--cursors 1-4] [--threads N] "
+    "[--validate-utf8] [--on-error abort|skip|count] [--header auto|yes|no] "
+    "[--delimiter CHAR] [--columns NAME,VALUE] [--scale 0-6] <old> <new>";
+
+size_t parse_size(std::string_view flag, std::string_view value) {
+  size_t result = 0;
+  auto [ptr, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (ec != std::errc() || ptr != value.data() + value.size()) {
+    throw std::invalid_argument("Invalid value for " + std::string(flag) +
+                                ": '" + std::string(value) + "'");
+  }
+  return result;
+}
 
-    name = station;
-    index.store(station_index, std::memory_order_release);
+double parse_fraction(std::string_view flag, std::string_view value) {
+  double result = 0;
+  auto [ptr, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (ec != std::errc() || ptr != value.data() + value.size() ||
+      !(result > 0.0 && result <= 1.0)) {
+    throw std::invalid_argument("Invalid value for " + std::string(flag) +
+                                ": '" + std::string(value) +
+                                "', expected a fraction in (0, 1]");
   }
+  return result;
+}
+
+Options parse_options(int argc, char *argv[]) {
+  Options options;
+  options.diff = argc > 1 && std::string_view(argv[1]) == "diff";
+  for (int i = options.diff ? 2 : 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (!arg.starts_with("--")) {
+      if (options.path.empty())
+        options.path = arg;
+      else if (options.diff && options.other_path.empty())
+        options.other_path = arg;
+      else
+        throw std::invalid_argument("Unexpected argument: " + std::string(arg));
+      continue;
+    }
+
+    if (arg == "--validate-utf8") {
+      options.scan.validate_utf8 = true;
+      continue;
+    }
+    if (arg == "--checksum") {
+      options.checksum = true;
+      continue;
+    }
+    if (arg == "--partial") {
+      options.partial = true;
+      continue;
+    }
+    if (arg == "--locate-extremes") {
+      options.locate_extremes = true;
+      continue;
+    }
+
+    if (i + 1 == argc)
+      throw std::invalid_argument("Missing value for " + std::string(arg));
+    std::string_view value = argv[++i];
+    if (arg == "--offset") {
+      options.offset = parse_size(arg, value);
+    } else if (arg == "--length") {
+      options.length = parse_size(arg, value);
+    } else if (arg == "--first-row") {
+      options.first_row = parse_size(arg, value);
+    } else if (arg == "--row-count") {
+      options.row_count = parse_size(arg, value);
+    } else if (arg == "--sample") {
+      options.sample = parse_fraction(arg, value);
+    } else if (arg == "--seed") {
+      options.seed = parse_size(arg, value);
+    } else if (arg == "--progressive") {
+      options.progress_interval = parse_size(arg, value);
+    } else if (arg == "--deadline") {
+      options.deadline = parse_size(arg, value);
+    } else if (arg == "--cache") {
+      options.cache_dir = value;
+    } else if (arg == "--threads") {
+      options.threads = parse_size(arg, value);
+      if (options.threads == 0)
+        throw std::invalid_argument("Invalid value for --threads: '" +
+                                    std::string(value) + "'");
+    } else if (arg == "--cursors") {
+      options.scan.cursors = parse_size(arg, value);
+      if (options.scan.cursors == 0 || options.scan.cursors > MAX_CURSORS)
+        throw std::invalid_argument("Invalid value for --cursors: '" +
+                                    std::string(value) + "'");
+    } else if (arg == "--header") {
+      if (value == "auto")
+        options.header = Header::Auto;
+      else if (value == "yes")
+        options.header = Header::Yes;
+      else if (value == "no")
+        options.header = Header::No;
+      else
+        throw std::invalid_argument("Invalid value for --header: '" +
+                                    std::string(value) + "'");
+    } else if (arg == "--delimiter") {
+      if (value == "tab")
+        value = "\t";
+      if (value.size() != 1 || value == "\n" || value == "\r")
+        throw std::invalid_argument("Invalid value for --delimiter: '" +
+                                    std::string(value) +
+                                    "', expected one character or 'tab'");
+      options.scan.columns.project = true;
+      options.scan.columns.delimiter = value[0];
+    } else if (arg == "--columns") {
+      // Numbered from 1 on the command line, like cut(1)
+      const size_t comma = value.find(',');
+      const size_t name =
+          comma == std::string_view::npos
+              ? 0
+              : parse_size(arg, value.substr(0, comma));
+      const size_t field =
+          comma == std::string_view::npos
+              ? 0
+              : parse_size(arg, value.substr(comma + 1));
+      if (name == 0 || field == 0 || name == field)
+        throw std::invalid_argument("Invalid value for --columns: '" +
+                                    std::string(value) +
+                                    "', expected two distinct fields N,M");
+      options.scan.columns.project = true;
+      options.scan.columns.name = name - 1;
+      options.scan.columns.value = field - 1;
+    } else if (arg == "--scale") {
+      const size_t scale = parse_size(arg, value);
+      if (scale > MAX_SCALE)
+        throw std::invalid_argument("Invalid value for --scale: '" +
+                                    std::string(value) + "'");
+      options.scan.scale = static_cast<int>(scale);
+    } else if (arg == "--threshold" && options.diff) {
+      auto [ptr, ec] = std::from_chars(value.data(),
+                                       value.data() + value.size(),
+                                       options.threshold);
+      if (ec != std::errc() || ptr != value.data() + value.size() ||
+          !(options.threshold >= 0))
+        throw std::invalid_argument("Invalid value for --threshold: '" +
+                                    std::string(value) + "'");
+    } else if (arg == "--metadata") {
+      options.metadata = value;
+    } else if (arg == "--where") {
+      const size_t equals = value.find('=');
+      if (equals == 0 || equals == std::string_view::npos)
+        throw std::invalid_argument("Invalid value for --where: '" +
+                                    std::string(value) +
+                                    "', expected ATTR=VALUE");
+      options.where.emplace_back(value.substr(0, equals),
+                                 value.substr(equals + 1));
+    } else if (arg == "--group-by") {
+      options.group_by = value;
+    } else if (arg == "--outliers") {
+      auto [ptr, ec] = std::from_chars(
+          value.data(), value.data() + value.size(), options.outliers);
+      if (ec != std::errc() || ptr != value.data() + value.size() ||
+          !(options.outliers > 0 && std::isfinite(options.outliers)))
+        throw std::invalid_argument("Invalid value for --outliers: '" +
+                                    std::string(value) +
+                                    "', expected a positive number");
+    } else if (arg == "--rollup") {
+      RollupKey key;
+      key.spec = value;
+      if (value.starts_with("prefix:")) {
+        key.kind = RollupKey::Kind::Prefix;
+        key.length = parse_size(arg, value.substr(7));
+        if (key.length == 0)
+          throw std::invalid_argument("Invalid value for --rollup: '" +
+                                      std::string(value) + "'");
+      } else if (value.starts_with("before:")) {
+        key.kind = RollupKey::Kind::Before;
+        if (value.size() != 8)
+          throw std::invalid_argument("Invalid value for --rollup: '" +
+                                      std::string(value) +
+                                      "', expected one separator character");
+        key.separator = value[7];
+      } else if (!value.empty()) {
+        key.attribute = value;
+      } else {
+        throw std::invalid_argument("Invalid value for --rollup: ''");
+      }
+      options.rollups.push_back(std::move(key));
+    } else if (arg == "--on-error") {
+      if (value == "abort")
+        options.scan.on_error = ErrorPolicy::Abort;
+      else if (value == "skip")
+        options.scan.on_error = ErrorPolicy::Skip;
+      else if (value == "count")
+        options.scan.on_error = ErrorPolicy::Count;
+      else
+        throw std::invalid_argument("Invalid value for --on-error: '" +
+                                    std::string(value) + "'");
+    } else {
+      throw std::invalid_argument("Unknown option: " + std::string(arg));
+    }
+  }
+
+  if (options.path.empty())
+    throw std::invalid_argument("provide absolute path to dataset");
+  // Each picks its own way through the chunks, main runs only one of them
+  if ((options.sample < 1.0) + (options.deadline > 0) +
+          (options.progress_interval > 0) >
+      1)
+    throw std::invalid_argument(
+        "--sample, --deadline and --progressive cannot be combined");
+  // Estimates from part of the input
+  const bool estimated = options.sample < 1.0 || options.deadline > 0 ||
+                         options.progress_interval > 0;
+  // Partial totals must be exact, and are read back whole
+  if (options.partial && (estimated || options.checksum || options.diff))
+    throw std::invalid_argument(
+        "--partial cannot be combined with --sample, --deadline, "
+        "--progressive, --checksum or diff");
+  if ((!options.where.empty() || !options.group_by.empty() ||
+       std::any_of(options.rollups.begin(), options.rollups.end(),
+                   [](const RollupKey &key) {
+                     return key.kind == RollupKey::Kind::Attribute;
+                   })) &&
+      options.metadata.empty())
+    throw std::invalid_argument(
+        "--where, --group-by and attribute roll-ups need --metadata");
+  // Options that annotate the printed exact results
+  const bool exact_only = !options.rollups.empty() ||
+                          options.locate_extremes || options.outliers > 0 ||
+                          !options.metadata.empty();
+  if (exact_only && (estimated || options.partial || options.diff))
+    throw std::invalid_argument(
+        "--rollup, --locate-extremes, --outliers and --metadata only apply "
+        "to exact results");
+  if (options.diff) {
+    if (options.other_path.empty())
+      throw std::invalid_argument("diff needs two paths");
+    if (estimated || !options.cache_dir.empty() || options.checksum ||
+        options.offset != 0 ||
+        options.length != std::numeric_limits<size_t>::max() ||
+        options.first_row != 0 ||
+        options.row_count != std::numeric_limits<size_t>::max())
+      throw std::invalid_argument("diff compares the exact totals of whole "
+                                  "files, only scan options apply");
+  }
+  return options;
+}
+
+// Vector operations used by the row scan on blocks of `Width` bytes. Each
+// instruction set the build targets specializes it for its register width;
+// the scalar fallback is the width-1 policy.
+template <size_t Width> struct Simd;
+
+template <> struct Simd<1> {
+  using Block = char;
+  using Mask = uint32_t;
+  static constexpr size_t WIDTH = 1;
+
+  static Block broadcast(const char c) { return c; }
+  static Block load(const char *data) { return *data; }
+  static Mask equal(const Block block, const Block value) {
+    return block == value;
+  }
+  static bool non_ascii(const Block block) { return block & 0x80; }
 };
 
-std::array<StationData, UNIQUE_NAMES> stations{};
+#if defined(USE_SSE2) || defined(USE_AVX2) || defined(USE_AVX512)
+template <> struct Simd<16> {
+  using Block = __m128i;
+  using Mask = uint32_t;
+  static constexpr size_t WIDTH = 16;
 
-void process_line(const std::string_view &line) {
-  size_t pos = line.find(';');
-  // No need to check for missing ';'
-  // since the data is assumed to be well-formed
+  static Block broadcast(const char c) { return _mm_set1_epi8(c); }
+  static Block load(const char *data) {
+    return _mm_loadu_si128(reinterpret_cast<const Block *>(data));
+  }
+  static Mask equal(const Block block, const Block value) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(block, value));
+  }
+  static bool non_ascii(const Block block) {
+    return _mm_movemask_epi8(block) != 0;
+  }
+};
+#endif
 
-  std::string_view station = line.substr(0, pos);
-  size_t index = std::hash<std::string_view>{}(station) % UNIQUE_NAMES;
+#if defined(USE_AVX2) || defined(USE_AVX512)
+template <> struct Simd<32> {
+  using Block = __m256i;
+  using Mask = uint32_t;
+  static constexpr size_t WIDTH = 32;
 
-  std::string_view measurement = line.substr(pos + 1);
-  float temperature = 0.0f;
-  auto [_, ec] = std::from_chars(
-      measurement.data(), measurement.data() + measurement.size(), temperature);
-  if (ec != std::errc()) {
-    std::cerr << "Error: failed to parse temperature (" << measurement << ')'
-              << std::endl;
-    throw 1;
+  static Block broadcast(const char c) { return _mm256_set1_epi8(c); }
+  static Block load(const char *data) {
+    return _mm256_loadu_si256(reinterpret_cast<const Block *>(data));
+  }
+  static Mask equal(const Block block, const Block value) {
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, value));
+  }
+  static bool non_ascii(const Block block) {
+    return _mm256_movemask_epi8(block) != 0;
   }
+};
+#endif
 
-  StationData &it = stations.at(index);
+#if defined(USE_AVX512)
+template <> struct Simd<64> {
+  using Block = __m512i;
+  using Mask = uint64_t;
+  static constexpr size_t WIDTH = 64;
 
-  float prevMin = it.min.load();
-  while (temperature < prevMin) {
-    if (it.min.compare_exchange_weak(prevMin, temperature))
-      break;
-    prevMin = it.min.load();
+  static Block broadcast(const char c) { return _mm512_set1_epi8(c); }
+  static Block load(const char *data) { return _mm512_loadu_si512(data); }
+  static Mask equal(const Block block, const Block value) {
+    return _mm512_cmpeq_epi8_mask(block, value);
+  }
+  static bool non_ascii(const Block block) {
+    return _mm512_movepi8_mask(block) != 0;
   }
 
-  float prevMax = it.max.load();
-  while (temperature > prevMax) {
-    if (it.max.compare_exchange_weak(prevMax, temperature))
-      break;
-    prevMax = it.max.load();
+#if defined(USE_AVX512_VBMI2)
+  // Writes the offsets of the set bits of `mask` to `offsets` at once with
+  // vpcompressb instead of one tzcnt per bit, returns their number
+  static unsigned compress(const Mask mask, uint8_t *offsets) {
+    alignas(64) static constexpr auto BYTE_OFFSETS = [] {
+      std::array<uint8_t, WIDTH> offsets{};
+      for (size_t i = 0; i < offsets.size(); ++i)
+        offsets[i] = i;
+      return offsets;
+    }();
+    _mm512_storeu_si512(offsets,
+                        _mm512_maskz_compress_epi8(
+                            mask, _mm512_load_si512(BYTE_OFFSETS.data())));
+    return std::popcount(mask);
   }
+#endif
+};
+#endif
+
+#if defined(USE_AVX512)
+using NativeSimd = Simd<64>;
+#elif defined(USE_AVX2)
+using NativeSimd = Simd<32>;
+#elif defined(USE_SSE2)
+using NativeSimd = Simd<16>;
+#else
+using NativeSimd = Simd<1>;
+#endif
+
+template <typename Policy>
+concept CompressesOffsets =
+    requires(typename Policy::Mask mask, uint8_t *offsets) {
+      { Policy::compress(mask, offsets) } -> std::convertible_to<unsigned>;
+    };
 
-  it.count.fetch_add(1);
-  it.sum.fetch_add(temperature);
+// Page size assumed by reads that may run past the end of a name. Such a
+// read cannot fault as long as it stays within the page of its first byte.
+constexpr size_t MIN_PAGE_SIZE = 4096;
 
-  it.set_name(std::move(station), index);
+inline bool within_page(const char *data, const size_t size) {
+  return (reinterpret_cast<uintptr_t>(data) & (MIN_PAGE_SIZE - 1)) <=
+         MIN_PAGE_SIZE - size;
 }
 
-#if defined(USE_NAIVE)
-std::vector<std::string_view> split_by_rows(const char *data,
-                                            const size_t size) {
-  std::vector<std::string_view> result;
+// Compares station names a block at a time without a byte-wise loop. On
+// AVX-512 every block is a masked load, so any length up to the 100 bytes
+// of the spec takes at most two compares. Narrower builds cover long names
+// with whole blocks, the last one overlapping the previous, and short names
+// with one block read past the name when that stays within the page.
+inline bool names_equal(const std::string_view &a, const std::string_view &b) {
+  const size_t size = a.size();
+  if (size != b.size())
+    return false;
 
-  size_t start = 0;
-  for (size_t i = 0; i < size; ++i) {
-    if (data[i] != '\n')
-      continue;
-    result.emplace_back(data + start, i - start);
-    start = i + 1;
+#if defined(USE_AVX512)
+  for (size_t offset = 0; offset < size; offset += 64) {
+    const size_t left = size - offset;
+    const __mmask64 mask = left >= 64 ? ~0ULL : (1ULL << left) - 1;
+    if (_mm512_mask_cmpneq_epi8_mask(
+            mask, _mm512_maskz_loadu_epi8(mask, a.data() + offset),
+            _mm512_maskz_loadu_epi8(mask, b.data() + offset)))
+      return false;
   }
+  return true;
+#else
+  using P = NativeSimd;
+  if constexpr (P::WIDTH == 1) {
+    return a == b;
+  } else {
+    constexpr auto ALL = static_cast<P::Mask>((1ULL << P::WIDTH) - 1);
+    auto equal_at = [&](size_t offset) {
+      return P::equal(P::load(a.data() + offset),
+                      P::load(b.data() + offset)) == ALL;
+    };
 
-  // Handle the last substring
-  if (start < size) {
-    result.emplace_back(data + start, size - start);
+    if (size >= P::WIDTH) {
+      for (size_t offset = 0; offset + P::WIDTH < size; offset += P::WIDTH) {
+        if (!equal_at(offset))
+          return false;
+      }
+      return equal_at(size - P::WIDTH);
+    }
+    if (within_page(a.data(), P::WIDTH) && within_page(b.data(), P::WIDTH)) {
+      const auto mask = static_cast<P::Mask>((1ULL << size) - 1);
+      return (P::equal(P::load(a.data()), P::load(b.data())) & mask) == mask;
+    }
+    return std::memcmp(a.data(), b.data(), size) == 0;
   }
+#endif
+}
 
-  return result;
+// Hashes every byte of a station name, a block of 16 at a time, so that
+// names differing anywhere land in different slots. Names of up to 16
+// bytes take one block: a masked load on AVX-512, elsewhere a read past
+// the name when that stays within the page. Longer names are covered with
+// whole blocks, the last one overlapping the previous, like names_equal.
+inline uint64_t hash_name(const std::string_view &name) {
+  const size_t size = name.size();
+  uint64_t hash = size;
+  const auto mix_block = [&hash](const uint64_t (&block)[2]) {
+    hash ^= block[0] * 0x9e3779b97f4a7c15;
+    hash ^= block[1] * 0xc2b2ae3d27d4eb4f;
+    hash = std::rotl(hash, 31) * 0x165667b19e3779f9;
+  };
+
+  uint64_t block[2] = {0, 0};
+  if (size > sizeof(block)) {
+    for (size_t offset = 0; offset + sizeof(block) < size;
+         offset += sizeof(block)) {
+      std::memcpy(block, name.data() + offset, sizeof(block));
+      mix_block(block);
+    }
+    std::memcpy(block, name.data() + size - sizeof(block), sizeof(block));
+    mix_block(block);
+  } else {
+#if defined(USE_AVX512)
+    const __mmask64 mask = (1ULL << size) - 1;
+    _mm512_mask_storeu_epi8(block, mask,
+                            _mm512_maskz_loadu_epi8(mask, name.data()));
+#elif !defined(USE_NAIVE)
+    if (within_page(name.data(), sizeof(block))) {
+      std::memcpy(block, name.data(), sizeof(block));
+      if (size < 8) {
+        block[0] &= (1ULL << (8 * size)) - 1;
+        block[1] = 0;
+      } else if (size < 16) {
+        block[1] &= (1ULL << (8 * (size - 8))) - 1;
+      }
+    } else {
+      std::memcpy(block, name.data(), size);
+    }
+#else
+    std::memcpy(block, name.data(), size);
+#endif
+    mix_block(block);
+  }
+
+  hash ^= hash >> 32;
+  hash *= 0x9e3779b97f4a7c15;
+  return hash ^ (hash >> 29);
 }
+
+// Byte positions of problems found by the scan. Reports go to one of
+// several shards picked by thread, so workers rarely share a lock, and
+// only happen on bad input. Each shard keeps its lowest MAX_REPORTED
+// positions, which makes the merged report independent of how chunks
+// were scheduled.
+class Diagnostics {
+  static constexpr size_t SHARDS = 64;
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::vector<const char *> positions;
+    std::atomic<size_t> total = 0;
+  };
+  std::array<Shard, SHARDS> shards;
+
+public:
+  void report(const char *position) {
+    Shard &shard =
+        shards[std::hash<std::thread::id>{}(std::this_thread::get_id()) %
+               SHARDS];
+    shard.total.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto &positions = shard.positions;
+    const size_t i =
+        std::upper_bound(positions.begin(), positions.end(), position) -
+        positions.begin();
+    if (i == MAX_REPORTED)
+      return;
+    if (positions.size() == MAX_REPORTED)
+      positions.pop_back();
+    positions.insert(positions.begin() + i, position);
+  }
+
+  [[nodiscard]] size_t count() const {
+    size_t total = 0;
+    for (const auto &shard : shards)
+      total += shard.total.load(std::memory_order_relaxed);
+    return total;
+  }
+
+  // The lowest MAX_REPORTED positions, only valid once the scan is done
+  [[nodiscard]] std::vector<const char *> first() const {
+    std::vector<const char *> merged;
+    for (const auto &shard : shards)
+      merged.insert(merged.end(), shard.positions.begin(),
+                    shard.positions.end());
+    std::sort(merged.begin(), merged.end());
+    merged.resize(std::min(merged.size(), MAX_REPORTED));
+    return merged;
+  }
+};
+
+// Values are fixed point, in units of 10^-scale. USE_WIDE_VALUES widens
+// them for inputs beyond the spec's two integer digits.
+#if defined(USE_WIDE_VALUES)
+using Value = int64_t;
 #else
-#include <emmintrin.h>
-#include <immintrin.h>
-#include <smmintrin.h>
-// Macros definitions for SIMD operations based on compiler flags
-#if defined(USE_AVX512)
-#define SIMD_TYPE __m512i
-#define SET_NEWLINE _mm512_set1_epi8
-#define LOAD_SI _mm512_loadu_si512
-#define MOVE_MASK(block, newline) _mm512_cmpeq_epi8_mask(block, newline)
-#define SIMD_TZCNT _tzcnt_u64
-#define SIMD_WIDTH 64
-#elif defined(USE_AVX2)
-#define SIMD_TYPE __m256i
-#define SET_NEWLINE _mm256_set1_epi8
-#define LOAD_SI _mm256_loadu_si256
-#define MOVE_MASK(block, newline)                                              \
-  _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline))
-#define SIMD_TZCNT _tzcnt_u32
-#define SIMD_WIDTH 32
-#elif defined(USE_SSE2)
-#define SIMD_TYPE __m128i
-#define SET_NEWLINE _mm_set1_epi8
-#define LOAD_SI _mm_loadu_si128
-#define MOVE_MASK(block, newline)                                              \
-  _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline))
-#define SIMD_TZCNT _tzcnt_u32
-#define SIMD_WIDTH 16
+using Value = int32_t;
 #endif
 
-std::vector<std::string_view> split_by_rows(const char *data, size_t size) {
-  std::vector<std::string_view> result;
-  const char *start = data;
-  SIMD_TYPE newline = SET_NEWLINE('\n');
+// One cache line per slot. find() reads `state`, `hash` and `name` of
+// every slot it probes and the row then updates the totals, so all of them
+// are on the line StationTable::prefetch loads. Statistics only some scans
+// keep are in side arrays of the table instead.
+struct alignas(64) StationData {
+  // EMPTY until a thread claims the slot for a station, READY once it
+  // has published `hash` and `name`
+  enum : uint8_t { EMPTY, CLAIMED, READY };
+  std::atomic<uint8_t> state = EMPTY;
+  // Set when `sum` wrapped around
+  std::atomic<bool> overflowed = false;
+  uint64_t hash = 0;
+  std::string_view name;
+
+  std::atomic<Value> min = std::numeric_limits<Value>::max();
+  std::atomic<Value> max = std::numeric_limits<Value>::lowest();
+  std::atomic<uint64_t> count = 0;
+  std::atomic<int64_t> sum = 0;
+};
+static_assert(sizeof(StationData) == 64);
+static_assert(offsetof(StationData, state) < 64 &&
+              offsetof(StationData, hash) + sizeof(uint64_t) <= 64 &&
+              offsetof(StationData, name) + sizeof(std::string_view) <= 64);
+
+// Statistics the scan keeps beyond the totals, as template flags so that a
+// scan without them does not pay for them
+enum Tracked : unsigned {
+  // Sums of squares for the deviations of --outliers
+  TRACK_VARIANCE = 1,
+  // Rows of the min and max readings
+  TRACK_EXTREMES = 2,
+  // Station of every row, in order, for a second pass over the same rows
+  TRACK_IDS = 4,
+  // Totals of every chunk, for the confidence intervals of sampled results
+  TRACK_CHUNKS = 8,
+};
+
+// Open addressing with linear probing, sized well above UNIQUE_NAMES
+constexpr size_t TABLE_SIZE = 1 << 14;
+static_assert(TABLE_SIZE > UNIQUE_NAMES && std::has_single_bit(TABLE_SIZE));
+
+// Slot of a station in the table. Rows that have none, being malformed or
+// past a full table, are NO_STATION.
+using StationId = uint16_t;
+constexpr StationId NO_STATION = std::numeric_limits<StationId>::max();
+static_assert(TABLE_SIZE <= NO_STATION);
+
+// Stations of the rows of a chunk, one stream per part a cursor scans, in
+// the order of the rows
+using ChunkIds = std::array<std::vector<StationId>, MAX_CURSORS>;
+
+// Rows and sum of each station within the chunk being scanned
+struct ChunkTotals {
+  std::array<std::pair<uint64_t, int64_t>, TABLE_SIZE> stations{};
+  // Slots with rows in the chunk, so that folding does not sweep the table
+  std::vector<StationId> seen;
+};
+
+// Where the scan of a part notes its rows, for the flags that need them
+struct RowTrace {
+  std::vector<StationId> *ids = nullptr;
+  ChunkTotals *totals = nullptr;
+};
+
+// Notes the station and value of the next row when the scan tracks them
+template <unsigned Track>
+inline void note_row(RowTrace *trace, const StationId id,
+                     const Value value = 0) {
+  if constexpr ((Track & TRACK_IDS) != 0)
+    trace->ids->push_back(id);
+  if constexpr ((Track & TRACK_CHUNKS) != 0) {
+    if (id == NO_STATION)
+      return;
+    auto &[count, sum] = trace->totals->stations[id];
+    if (count++ == 0)
+      trace->totals->seen.push_back(id);
+    sum += value;
+  }
+}
+
+// Sums over the scanned chunks of x², xy and y², where x is the number of
+// rows of a station in a chunk and y their sum. Only sampling scans fold
+// them, so they are kept apart from the slots every row probes.
+struct ChunkSums {
+  __int128 xx = 0;
+  __int128 xy = 0;
+  __int128 yy = 0;
+  mutable std::atomic_flag lock;
+};
+
+// Only located with TRACK_EXTREMES: the first rows in the file holding the
+// `min` and `max` of a station. Updates take `lock` to change a value and
+// its row together. Kept apart from the slots like ChunkSums.
+struct ExtremeRows {
+  std::atomic<const char *> min_at = nullptr;
+  std::atomic<const char *> max_at = nullptr;
+  std::atomic_flag lock;
+};
+
+// Only kept for --outliers: the sum of the squared values of a station,
+// accumulated with TRACK_VARIANCE as the low and high words of a 128-bit
+// integer so the total does not depend on the order of the adds, and the
+// readings the second pass found beyond its bounds. Kept apart from the
+// slots like ChunkSums.
+struct Deviations {
+  std::atomic<uint64_t> sum_sq_low = 0;
+  std::atomic<uint64_t> sum_sq_high = 0;
+  std::atomic<uint64_t> outliers = 0;
+};
 
-  // Process data in chunks of SIMD_WIDTH
-  while (size >= SIMD_WIDTH) {
-    SIMD_TYPE block = LOAD_SI(reinterpret_cast<const SIMD_TYPE *>(data));
-    auto mask = MOVE_MASK(block, newline);
+// Totals per station, updated concurrently by the scan threads
+class StationTable {
+  std::array<StationData, TABLE_SIZE> slots{};
+  std::array<ExtremeRows, TABLE_SIZE> extreme_rows{};
+  std::array<Deviations, TABLE_SIZE> deviations{};
+  // Set once a station found no free slot, which ends the scan
+  std::atomic<bool> filled = false;
 
-    while (mask != 0) {
-      int bit = SIMD_TZCNT(mask);
-      result.emplace_back(start, data + bit);
-      start = data + bit + 1;
-      mask &= mask - 1; // Clear the lowest set bit
+  static void lower(std::atomic<Value> &min, const Value value) {
+    Value prevMin = min.load();
+    while (value < prevMin) {
+      if (min.compare_exchange_weak(prevMin, value))
+        break;
+      prevMin = min.load();
     }
+  }
 
-    data += SIMD_WIDTH;
-    size -= SIMD_WIDTH;
+  static void raise(std::atomic<Value> &max, const Value value) {
+    Value prevMax = max.load();
+    while (value > prevMax) {
+      if (max.compare_exchange_weak(prevMax, value))
+        break;
+      prevMax = max.load();
+    }
   }
 
-  // Handle any remaining characters
-  while (size > 0) {
-    if (*data == '\n') {
-      result.emplace_back(start, data);
-      start = data + 1;
+  // Moves `extreme` to `value` and `at` to `row` when `value` is better,
+  // or as good and earlier in the file. The earliest row wins whichever
+  // thread sees it first, so the result does not depend on scheduling.
+  // Writers publish `at` before `extreme`, and the unlocked check loads
+  // them in the opposite order. A row that check sees next to a value is
+  // therefore at least as early as the row first stored with it, so a
+  // tying row never loses to one later in the file.
+  template <typename Better>
+  static void locate(std::atomic_flag &lock, std::atomic<Value> &extreme,
+                     std::atomic<const char *> &at, const Value value,
+                     const char *row, const Better better) {
+    const auto wins = [&] {
+      const Value current = extreme.load(std::memory_order_acquire);
+      const char *current_at = at.load(std::memory_order_relaxed);
+      return better(value, current) ||
+             (value == current && (current_at == nullptr || row < current_at));
+    };
+    // Most rows lose without taking the lock
+    if (!wins())
+      return;
+    while (lock.test_and_set(std::memory_order_acquire))
+      std::this_thread::yield();
+    if (wins()) {
+      at.store(row, std::memory_order_relaxed);
+      extreme.store(value, std::memory_order_release);
     }
-    data++;
-    size--;
+    lock.clear(std::memory_order_release);
   }
 
-  // Add the last piece if there's no newline at the end
-  if (start != data) {
-    result.emplace_back(start, data);
+  static void add(StationData &it, const uint64_t count, const int64_t sum) {
+    it.count.fetch_add(count);
+    int64_t total;
+    if (__builtin_add_overflow(it.sum.fetch_add(sum), sum, &total))
+        [[unlikely]]
+      it.overflowed.store(true, std::memory_order_relaxed);
   }
 
-  return result;
-}
+  // Chunks folded by add_chunk, and the sums they left for each slot
+  std::atomic<uint64_t> chunks = 0;
+  std::array<ChunkSums, TABLE_SIZE> chunk_sums{};
+
+public:
+  // Returns the slot of `station`, claiming an empty one when the station
+  // is seen for the first time, or nullptr when the table is full
+  StationData *find(const std::string_view &station, const uint64_t hash) {
+    for (size_t probe = 0, i = hash & (TABLE_SIZE - 1); probe < TABLE_SIZE;
+         ++probe, i = (i + 1) & (TABLE_SIZE - 1)) {
+      StationData &slot = slots[i];
+      uint8_t state = slot.state.load(std::memory_order_acquire);
+      if (state == StationData::EMPTY &&
+          slot.state.compare_exchange_strong(state, StationData::CLAIMED,
+                                             std::memory_order_acquire)) {
+        slot.hash = hash;
+        slot.name = station;
+        slot.state.store(StationData::READY, std::memory_order_release);
+        return &slot;
+      }
+
+      // Another thread is publishing the station of this slot
+      while (state != StationData::READY) {
+        std::this_thread::yield();
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (slot.hash == hash && names_equal(slot.name, station))
+        return &slot;
+    }
+
+    filled.store(true, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  // Loads the line of the first slot find() probes for `hash`
+  void prefetch(const uint64_t hash) const {
+    __builtin_prefetch(&slots[hash & (TABLE_SIZE - 1)], 1);
+  }
+
+  // Adds `value` read from the row starting at `row`. Returns the slot of
+  // the station.
+  template <unsigned Track = 0>
+  StationId record(const std::string_view &station, const uint64_t hash,
+                   const Value value, const char *row) {
+    StationData *slot = find(station, hash);
+    if (slot == nullptr) [[unlikely]]
+      return NO_STATION;
+    StationData &it = *slot;
+    const auto id = static_cast<StationId>(slot - slots.data());
+
+    if constexpr ((Track & TRACK_EXTREMES) != 0) {
+      ExtremeRows &rows = extreme_rows[id];
+      locate(rows.lock, it.min, rows.min_at, value, row, std::less<>());
+      locate(rows.lock, it.max, rows.max_at, value, row, std::greater<>());
+    } else {
+      lower(it.min, value);
+      raise(it.max, value);
+    }
+    add(it, 1, value);
+    if constexpr ((Track & TRACK_VARIANCE) != 0) {
+      const auto square = static_cast<unsigned __int128>(
+          static_cast<__int128>(value) * value);
+      const auto low = static_cast<uint64_t>(square);
+      Deviations &squares = deviations[id];
+      const uint64_t carry = squares.sum_sq_low.fetch_add(low) + low < low;
+      if (const uint64_t high = (square >> 64) + carry; high != 0)
+        squares.sum_sq_high.fetch_add(high);
+    }
+    return id;
+  }
+
+  // Adds totals aggregated by another run
+  void merge(const std::string_view &station, const uint64_t count,
+             const int64_t sum, const Value min, const Value max) {
+    StationData *slot = find(station, hash_name(station));
+    if (slot == nullptr)
+      return;
+    lower(slot->min, min);
+    raise(slot->max, max);
+    add(*slot, count, sum);
+  }
+
+  // Folds the totals of a scanned chunk into the sums over chunks of each
+  // station and clears them for the next chunk
+  void add_chunk(ChunkTotals &totals) {
+    for (const StationId id : totals.seen) {
+      auto &[count, sum] = totals.stations[id];
+      const auto x = static_cast<__int128>(count);
+      const auto y = static_cast<__int128>(sum);
+      ChunkSums &it = chunk_sums[id];
+      while (it.lock.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+      it.xx += x * x;
+      it.xy += x * y;
+      it.yy += y * y;
+      it.lock.clear(std::memory_order_release);
+      count = 0;
+      sum = 0;
+    }
+    totals.seen.clear();
+    chunks.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t chunks_added() const {
+    return chunks.load(std::memory_order_relaxed);
+  }
+
+  // The sums add_chunk keeps for `station`, read under their lock since a
+  // progressive scan may still be folding chunks
+  [[nodiscard]] std::array<__int128, 3>
+  sums_over_chunks(const StationData &station) const {
+    const ChunkSums &it = chunk_sums[&station - slots.data()];
+    while (it.lock.test_and_set(std::memory_order_acquire))
+      std::this_thread::yield();
+    std::array<__int128, 3> sums{it.xx, it.xy, it.yy};
+    it.lock.clear(std::memory_order_release);
+    return sums;
+  }
+
+  // Rows of the min and max of `station`, located with TRACK_EXTREMES
+  [[nodiscard]] const ExtremeRows &rows_of(const StationData &station) const {
+    return extreme_rows[&station - slots.data()];
+  }
+
+  [[nodiscard]] const StationData &at(const StationId id) const {
+    return slots[id];
+  }
+
+  // Sum of the squared values of slot `id`, with TRACK_VARIANCE
+  [[nodiscard]] unsigned __int128 sum_of_squares(const StationId id) const {
+    return static_cast<unsigned __int128>(deviations[id].sum_sq_high) << 64 |
+           deviations[id].sum_sq_low;
+  }
+
+  void count_outlier(const StationId id) {
+    deviations[id].outliers.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t outliers_of(const StationData &station) const {
+    return deviations[&station - slots.data()].outliers.load(
+        std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] bool full() const {
+    return filled.load(std::memory_order_relaxed);
+  }
+
+  // Stations seen by the scan, ordered by name. The slots they were given
+  // depend on which thread saw them first, their names do not.
+  [[nodiscard]] std::vector<const StationData *> sorted() const {
+    std::vector<const StationData *> seen;
+    for (const auto &station : slots) {
+      if (station.count != 0)
+        seen.push_back(&station);
+    }
+    std::sort(seen.begin(), seen.end(),
+              [](const StationData *a, const StationData *b) {
+                return a->name < b->name;
+              });
+    return seen;
+  }
+};
+
+// Everything the scan of one input produces
+struct Aggregate {
+  StationTable stations;
+  // Starts of rows that are not a name, ';' and a number
+  Diagnostics malformed_rows;
+  Diagnostics invalid_utf8;
+};
+
+// Decodes a value with `Scale` decimals and up to two integer digits, or
+// six for integers, that ends right before `end` with a single 8-byte
+// load, so rows that follow the spec need no forward search for ';'. With
+// USE_WIDE_VALUES the integer part may fill the rest of the 8 bytes.
+// Returns the length of the value, or 0 if the bytes do not have that form
+// or are not preceded by ';'.
+template <int Scale>
+inline size_t parse_value_backward(const char *end, Value &value) {
+  static_assert(Scale >= 0 && Scale <= 2);
+#if defined(USE_WIDE_VALUES)
+  // Leaves room for the sign and ';'
+  constexpr size_t INTEGER_DIGITS = 6 - Scale - (Scale > 0);
+#else
+  constexpr size_t INTEGER_DIGITS = Scale == 0 ? 6 : 2;
 #endif
-} // namespace
 
-int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Error: provide absolute path to dataset" << std::endl;
-    return 1;
+  uint64_t word;
+  std::memcpy(&word, end - sizeof(word), sizeof(word));
+  if constexpr (std::endian::native == std::endian::big)
+    word = std::byteswap(word);
+  // Byte 7 is the last one before `end`
+  const auto byte = [word](size_t i) -> unsigned {
+    return static_cast<unsigned char>(word >> (8 * i));
+  };
+
+  Value magnitude = 0;
+  size_t length = 0;
+  for (; length < Scale; ++length) {
+    const unsigned digit = byte(7 - length) - '0';
+    if (digit > 9)
+      return 0;
+    magnitude += digit * POW10[length];
+  }
+  if constexpr (Scale > 0) {
+    if (byte(7 - length) != '.')
+      return 0;
+    ++length;
   }
 
-  MappedFile file;
-  try {
-    file = MappedFile{argv[1]};
-  } catch (const std::exception &e) {
-    std::cerr << e.what() << std::endl;
-    return 1;
+  // The units are required, further integer digits optional
+  const size_t units = length;
+  for (; length < units + INTEGER_DIGITS; ++length) {
+    const unsigned digit = byte(7 - length) - '0';
+    if (digit > 9)
+      break;
+    magnitude += digit * POW10[Scale + length - units];
   }
+  if (length == units)
+    return 0;
 
-  auto rows = split_by_rows(file.data(), file.size());
-  std::println("Finished parsing file");
-  std::for_each(std::execution::par_unseq, rows.begin(), rows.end(),
-                [](std::string_view row) { process_line(row); });
+  if (byte(7 - length) == '-') {
+    magnitude = -magnitude;
+    ++length;
+  }
+  if (byte(7 - length) != ';')
+    return 0;
 
-  std::cout << std::fixed << std::setprecision(1) << "{";
-  for (size_t i = 0; const auto &station : stations) {
-    if (station.count == 0)
+  value = magnitude;
+  return length;
+}
+
+// Parses all of `text` as a decimal number into units of 10^-scale. Extra
+// decimals are rounded half away from zero. This is the generic parser
+// for any scale and for values the kernels do not cover.
+inline bool parse_fixed(const std::string_view &text, const int scale,
+                        Value &value) {
+  const char *p = text.data();
+  const char *end = p + text.size();
+  const bool negative = p != end && *p == '-';
+  p += negative;
+
+  // Fails on values out of the range of Value
+  Value magnitude = 0;
+  bool overflow = false;
+  const auto shift_in = [&](const Value multiplier, const Value digit) {
+    overflow |= __builtin_mul_overflow(magnitude, multiplier, &magnitude) ||
+                __builtin_add_overflow(magnitude, digit, &magnitude);
+  };
+
+  const char *digits = p;
+  for (; p != end && static_cast<unsigned>(*p - '0') <= 9; ++p)
+    shift_in(10, *p - '0');
+  if (p == digits)
+    return false;
+
+  int decimals = 0;
+  bool round_up = false;
+  if (p != end && *p == '.') {
+    ++p;
+    for (; p != end && static_cast<unsigned>(*p - '0') <= 9; ++p, ++decimals) {
+      if (decimals < scale)
+        shift_in(10, *p - '0');
+      else if (decimals == scale)
+        round_up = *p >= '5';
+    }
+  }
+  if (p != end)
+    return false;
+
+  shift_in(static_cast<Value>(POW10[std::max(0, scale - decimals)]), round_up);
+  if (overflow)
+    return false;
+  value = negative ? -magnitude : magnitude;
+  return true;
+}
+
+// Finds the name and value fields of `row`. Blocks in which no wanted
+// field ends are skipped by counting their delimiters, so unused columns
+// are never looked at byte by byte. Returns false if the row has too few
+// fields.
+inline bool project_fields(const std::string_view &row, const Columns &columns,
+                           std::string_view &name, std::string_view &value) {
+  using P = NativeSimd;
+  const auto delimiter = P::broadcast(columns.delimiter);
+  const size_t first = std::min(columns.name, columns.value);
+  const size_t last = std::max(columns.name, columns.value);
+  const char *end = row.data() + row.size();
+
+  // Start and index of the current field
+  const char *field = row.data();
+  size_t index = 0;
+  const auto close = [&](const char *field_end) {
+    if (index == columns.name)
+      name = std::string_view(field, field_end);
+    else if (index == columns.value)
+      value = std::string_view(field, field_end);
+    ++index;
+    field = field_end + 1;
+  };
+
+  const char *p = row.data();
+  for (; index <= last && p + P::WIDTH <= end; p += P::WIDTH) {
+    auto mask = P::equal(P::load(p), delimiter);
+    const size_t delimiters = std::popcount(mask);
+    if (index + delimiters <= (index <= first ? first : last)) {
+      index += delimiters;
+      if (mask != 0)
+        field = p + std::bit_width(mask);
       continue;
+    }
+    for (; mask != 0 && index <= last; mask &= mask - 1)
+      close(p + std::countr_zero(mask));
+  }
+  for (; index <= last && p != end; ++p) {
+    if (*p == columns.delimiter)
+      close(p);
+  }
+  if (index <= last)
+    close(end);
+  return index > last;
+}
 
-    if (i != 0)
-      std::cout << ", ";
-    std::cout << station.name << '=' // '(' << station.index << ")="
-              << station.min << '/' << station.max << '/'
-              << station.sum / static_cast<float>(station.count);
-    ++i;
+// Splits a row into its name and value fields, projected or at the first
+// ';'. Returns false if the row does not have them.
+inline bool split_row(const std::string_view &row, const Columns &columns,
+                      std::string_view &name, std::string_view &value) {
+  if (columns.project)
+    return project_fields(row, columns, name, value);
+
+  const size_t pos = row.find(';');
+  if (pos == std::string_view::npos)
+    return false;
+  name = row.substr(0, pos);
+  value = row.substr(pos + 1);
+  return true;
+}
+
+// Parses a row with the generic parser, for projected files and scales
+// without a kernel
+template <unsigned Track = 0>
+void process_generic_line(const std::string_view &line,
+                          const ScanOptions &scan, Aggregate &aggregate,
+                          RowTrace *trace) {
+  if (line.empty())
+    return;
+
+  std::string_view station;
+  std::string_view text;
+  Value value = 0;
+  if (!split_row(line, scan.columns, station, text) ||
+      !parse_fixed(text, scan.scale, value)) [[unlikely]] {
+    aggregate.malformed_rows.report(line.data());
+    note_row<Track>(trace, NO_STATION);
+    return;
   }
-  std::cout << "}" << std::endl;
+  note_row<Track>(trace,
+                  aggregate.stations.record<Track>(station, hash_name(station),
+                                                   value, line.data()),
+                  value);
+}
 
-  return 0;
+template <unsigned Track, int Scale>
+void process_line(const std::string_view &line, Aggregate &aggregate,
+                  RowTrace *trace) {
+  Value value = 0;
+  // The backward load must stay within the mapping, which is only
+  // guaranteed for rows of at least 8 bytes
+  size_t value_length =
+      line.size() >= sizeof(uint64_t)
+          ? parse_value_backward<Scale>(line.data() + line.size(), value)
+          : 0;
+
+  size_t pos;
+  if (value_length != 0) {
+    pos = line.size() - value_length - 1;
+  } else {
+    pos = line.find(';');
+    if (pos == std::string_view::npos ||
+        !parse_fixed(line.substr(pos + 1), Scale, value)) [[unlikely]] {
+      aggregate.malformed_rows.report(line.data());
+      note_row<Track>(trace, NO_STATION);
+      return;
+    }
+  }
+
+  std::string_view station = line.substr(0, pos);
+  note_row<Track>(trace,
+                  aggregate.stations.record<Track>(station, hash_name(station),
+                                                   value, line.data()),
+                  value);
+}
+
+// Calls `report` with the first byte of every invalid UTF-8 sequence in
+// [begin, end), which must start on a sequence boundary. Like most
+// decoders, it takes the longest prefix of a valid sequence as one error.
+template <typename F>
+void find_invalid_utf8(const char *begin, const char *end, F &&report) {
+  const auto *p = reinterpret_cast<const unsigned char *>(begin);
+  const auto *last = reinterpret_cast<const unsigned char *>(end);
+  while (p < last) {
+    const unsigned char lead = *p;
+    if (lead < 0x80) {
+      ++p;
+      continue;
+    }
+
+    // Valid range of the second byte, which rules out overlong encodings,
+    // surrogates and code points above U+10FFFF
+    size_t length = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+      length = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+      length = 3;
+      low = lead == 0xe0 ? 0xa0 : low;
+      high = lead == 0xed ? 0x9f : high;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+      length = 4;
+      low = lead == 0xf0 ? 0x90 : low;
+      high = lead == 0xf4 ? 0x8f : high;
+    }
+
+    // An invalid sequence extends over the valid prefix of its bytes
+    size_t valid = length == 0 || p + 1 == last || p[1] < low || p[1] > high
+                       ? 1
+                       : 2;
+    while (valid > 1 && valid < length && p + valid != last &&
+           (p[valid] & 0xc0) == 0x80)
+      ++valid;
+    if (valid != length)
+      report(reinterpret_cast<const char *>(p));
+    p += valid;
+  }
+}
+
+// Flags blocks that may hold invalid UTF-8, carrying state from one block
+// of a range to the next. The rows of a flagged block are then checked with
+// find_invalid_utf8. This fallback flags every block that is not ASCII.
+template <typename Policy> class Utf8Check {
+public:
+  bool operator()(const typename Policy::Block &block) {
+    return Policy::non_ascii(block);
+  }
+};
+
+// Classification tables of the lookup validator by Keiser and Lemire
+// ("Validating UTF-8 In Less Than One Instruction Per Byte"), as used by
+// simdutf. Each error bit is set in all three lookups only for the byte
+// pairs that produce that error.
+namespace utf8 {
+constexpr uint8_t TOO_SHORT = 1 << 0;
+constexpr uint8_t TOO_LONG = 1 << 1;
+constexpr uint8_t OVERLONG_3 = 1 << 2;
+constexpr uint8_t TOO_LARGE = 1 << 3;
+constexpr uint8_t SURROGATE = 1 << 4;
+constexpr uint8_t OVERLONG_2 = 1 << 5;
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr uint8_t OVERLONG_4 = 1 << 6;
+constexpr uint8_t TWO_CONTS = 1 << 7;
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+// Repeats a 16-entry table for every 128-bit lane of the widest block
+consteval std::array<uint8_t, 64>
+lanes(const std::array<uint8_t, 16> &table) {
+  std::array<uint8_t, 64> repeated{};
+  for (size_t i = 0; i < repeated.size(); ++i)
+    repeated[i] = table[i % table.size()];
+  return repeated;
+}
+
+// By the high nibble of the previous byte
+alignas(64) constexpr auto BYTE_1_HIGH = lanes({
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4});
+
+// By the low nibble of the previous byte
+alignas(64) constexpr auto BYTE_1_LOW = lanes({
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000});
+
+// By the high nibble of the current byte
+alignas(64) constexpr auto BYTE_2_HIGH = lanes({
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+        OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT});
+} // namespace utf8
+
+#if defined(USE_AVX2) || defined(USE_AVX512)
+template <> class Utf8Check<Simd<32>> {
+  __m256i prev_input = _mm256_setzero_si256();
+  // Non-zero where the previous block ends inside a sequence
+  __m256i prev_incomplete = _mm256_setzero_si256();
+
+  static __m256i lookup(const std::array<uint8_t, 64> &table,
+                        const __m256i index) {
+    return _mm256_shuffle_epi8(
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(table.data())),
+        index);
+  }
+
+  // The input shifted by N bytes, continued from the previous block
+  template <int N> __m256i prev(const __m256i input) const {
+    return _mm256_alignr_epi8(
+        input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - N);
+  }
+
+public:
+  bool operator()(const __m256i &input) {
+    if (_mm256_movemask_epi8(input) == 0) {
+      const bool error = !_mm256_testz_si256(prev_incomplete, prev_incomplete);
+      prev_input = input;
+      prev_incomplete = _mm256_setzero_si256();
+      return error;
+    }
+
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i prev1 = prev<1>(input);
+    const __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            lookup(utf8::BYTE_1_HIGH,
+                   _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            lookup(utf8::BYTE_1_LOW, _mm256_and_si256(prev1, nibble))),
+        lookup(utf8::BYTE_2_HIGH,
+               _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+    // Continuations required by 3 and 4 byte leads two and three back
+    const __m256i must_continue = _mm256_and_si256(
+        _mm256_or_si256(
+            _mm256_subs_epu8(prev<2>(input), _mm256_set1_epi8(0xe0 - 0x80)),
+            _mm256_subs_epu8(prev<3>(input), _mm256_set1_epi8(0xf0 - 0x80))),
+        _mm256_set1_epi8(0x80));
+    const __m256i error = _mm256_xor_si256(must_continue, special);
+
+    // A lead byte in the last three bytes may need the next block
+    prev_incomplete = _mm256_subs_epu8(
+        input, _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                -1, -1, -1, -1, -1, -1, -1, 0xf0 - 1,
+                                0xe0 - 1, 0xc0 - 1));
+    prev_input = input;
+    return !_mm256_testz_si256(error, error);
+  }
+};
+#endif
+
+#if defined(USE_AVX512)
+template <> class Utf8Check<Simd<64>> {
+  __m512i prev_input = _mm512_setzero_si512();
+  // Non-zero where the previous block ends inside a sequence
+  __m512i prev_incomplete = _mm512_setzero_si512();
+
+  static __m512i lookup(const std::array<uint8_t, 64> &table,
+                        const __m512i index) {
+    return _mm512_shuffle_epi8(_mm512_load_si512(table.data()), index);
+  }
+
+  // The input shifted by N bytes, continued from the previous block
+  template <int N> __m512i prev(const __m512i input) const {
+    // 128-bit lanes: the last of the previous block, then the first three
+    const __m512i lanes = _mm512_permutex2var_epi64(
+        input, _mm512_set_epi64(5, 4, 3, 2, 1, 0, 15, 14), prev_input);
+    return _mm512_alignr_epi8(input, lanes, 16 - N);
+  }
+
+public:
+  bool operator()(const __m512i &input) {
+    if (_mm512_movepi8_mask(input) == 0) {
+      const bool error =
+          _mm512_test_epi8_mask(prev_incomplete, prev_incomplete) != 0;
+      prev_input = input;
+      prev_incomplete = _mm512_setzero_si512();
+      return error;
+    }
+
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    const __m512i prev1 = prev<1>(input);
+    const __m512i special = _mm512_and_si512(
+        _mm512_and_si512(
+            lookup(utf8::BYTE_1_HIGH,
+                   _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibble)),
+            lookup(utf8::BYTE_1_LOW, _mm512_and_si512(prev1, nibble))),
+        lookup(utf8::BYTE_2_HIGH,
+               _mm512_and_si512(_mm512_srli_epi16(input, 4), nibble)));
+
+    // Continuations required by 3 and 4 byte leads two and three back
+    const __m512i must_continue = _mm512_and_si512(
+        _mm512_or_si512(
+            _mm512_subs_epu8(prev<2>(input), _mm512_set1_epi8(0xe0 - 0x80)),
+            _mm512_subs_epu8(prev<3>(input), _mm512_set1_epi8(0xf0 - 0x80))),
+        _mm512_set1_epi8(0x80));
+    const __m512i error = _mm512_xor_si512(must_continue, special);
+
+    // A lead byte in the last three bytes may need the next block
+    alignas(64) static constexpr auto INCOMPLETE_BELOW = [] {
+      std::array<uint8_t, 64> bytes;
+      bytes.fill(0xff);
+      bytes[61] = 0xf0 - 1;
+      bytes[62] = 0xe0 - 1;
+      bytes[63] = 0xc0 - 1;
+      return bytes;
+    }();
+    prev_incomplete = _mm512_subs_epu8(
+        input, _mm512_load_si512(INCOMPLETE_BELOW.data()));
+    prev_input = input;
+    return _mm512_test_epi8_mask(error, error) != 0;
+  }
+};
+#endif
+
+// Iterates over the rows of a range one at a time, so that several
+// cursors can be advanced in lockstep. With ValidateUtf8 the loaded blocks
+// are also checked for invalid UTF-8, which is reported to `invalid_utf8`.
+template <typename Policy, bool ValidateUtf8 = false> class BasicRowCursor {
+  using Mask = typename Policy::Mask;
+  static constexpr size_t WIDTH = Policy::WIDTH;
+
+  // Next block to load, `mask` holds the unvisited newlines of the
+  // block before it
+  const char *data = nullptr;
+  const char *start = nullptr;
+  const char *end = nullptr;
+  Mask mask = 0;
+  // Offsets of the newlines of that block when the policy extracts them
+  // all at once
+  alignas(64) std::array<uint8_t, WIDTH> offsets;
+  unsigned offset_count = 0;
+  unsigned offset_index = 0;
+
+  const char *begin = nullptr;
+  // Rows before this have been checked for invalid UTF-8 byte by byte
+  const char *checked_until = nullptr;
+  bool tail_checked = false;
+  Utf8Check<Policy> utf8;
+  Diagnostics *invalid_utf8 = nullptr;
+
+  // Rows of files with CRLF line endings lose their '\r' here
+  static std::string_view row_between(const char *begin, const char *end) {
+    if (end != begin && end[-1] == '\r')
+      --end;
+    return std::string_view(begin, end);
+  }
+
+  bool emit(const char *newline, std::string_view &row) {
+    row = row_between(start, newline);
+    start = newline + 1;
+    return true;
+  }
+
+  typename Policy::Block load(const char *block) {
+    const auto loaded = Policy::load(block);
+    if constexpr (ValidateUtf8) {
+      if (utf8(loaded)) [[unlikely]]
+        check_rows(block - 3, block + WIDTH);
+    }
+    return loaded;
+  }
+
+  // Reports the invalid sequences in the rows overlapping [from, to). A
+  // flagged block may be continuing a sequence from the 3 bytes before it.
+  void check_rows(const char *from, const char *to) {
+    if (to <= checked_until)
+      return;
+    from = std::max(from, begin);
+    if (from <= checked_until)
+      from = checked_until;
+    else
+      while (from != begin && from[-1] != '\n')
+        --from;
+    to = std::find(std::min(to, end), end, '\n');
+    if (to != end)
+      ++to;
+
+    find_invalid_utf8(from, to, [this](const char *position) {
+      invalid_utf8->report(position);
+    });
+    checked_until = std::max(checked_until, to);
+  }
+
+public:
+  BasicRowCursor() = default;
+  BasicRowCursor(const std::string_view &range, Diagnostics *invalid_utf8)
+      : data(range.data()), start(range.data()),
+        end(range.data() + range.size()), begin(range.data()),
+        checked_until(range.data()), invalid_utf8(invalid_utf8) {}
+
+  bool next(std::string_view &row) {
+    const auto newline = Policy::broadcast('\n');
+
+    // Process data in chunks of WIDTH
+    if constexpr (CompressesOffsets<Policy>) {
+      while (offset_index == offset_count &&
+             static_cast<size_t>(end - data) >= WIDTH) {
+        offset_count =
+            Policy::compress(Policy::equal(load(data), newline), offsets.data());
+        offset_index = 0;
+        data += WIDTH;
+      }
+      if (offset_index != offset_count)
+        return emit(data - WIDTH + offsets[offset_index++], row);
+    } else {
+      while (mask == 0 && static_cast<size_t>(end - data) >= WIDTH) {
+        mask = Policy::equal(load(data), newline);
+        data += WIDTH;
+      }
+      if (mask != 0) {
+        const int bit = std::countr_zero(mask);
+        mask &= mask - 1; // Clear the lowest set bit
+        return emit(data - WIDTH + bit, row);
+      }
+    }
+
+    // Handle any remaining characters
+    if constexpr (ValidateUtf8) {
+      if (!tail_checked) {
+        tail_checked = true;
+        check_rows(start, end);
+      }
+    }
+    for (; data != end; ++data) {
+      if (*data == '\n')
+        return emit(data++, row);
+    }
+
+    // Add the last piece if there's no newline at the end
+    if (start != end) {
+      row = row_between(start, end);
+      start = end;
+      return true;
+    }
+    return false;
+  }
+};
+
+template <bool ValidateUtf8 = false>
+using RowCursor = BasicRowCursor<NativeSimd, ValidateUtf8>;
+
+// Splits `data` into chunks of roughly `chunk_size` bytes ending on a row
+// boundary, which are the unit of work for the parallel scan
+std::vector<std::string_view> split_into_chunks(std::string_view data,
+                                                const size_t chunk_size) {
+  std::vector<std::string_view> chunks;
+  while (!data.empty()) {
+    size_t end = data.size() <= chunk_size ? std::string_view::npos
+                                           : data.find('\n', chunk_size);
+    end = end == std::string_view::npos ? data.size() : end + 1;
+    chunks.push_back(data.substr(0, end));
+    data.remove_prefix(end);
+  }
+  return chunks;
+}
+
+// Parts of `chunk` for up to `cursors` cursors. Parts of at least one byte
+// guarantee at most `cursors` of them.
+std::vector<std::string_view> split_parts(const std::string_view &chunk,
+                                          const size_t cursors) {
+  return split_into_chunks(
+      chunk, std::max<size_t>(
+                 1, chunk.size() / std::clamp<size_t>(cursors, 1, MAX_CURSORS)));
+}
+
+// Loads the 8 bytes that end at the end of `row`
+inline uint64_t load_tail(const std::string_view &row) {
+  uint64_t word;
+  std::memcpy(&word, row.data() + row.size() - sizeof(word), sizeof(word));
+  return word;
+}
+
+// Byte weights of the batched parse, per 64-bit lane holding the last 8
+// bytes of a row. A byte multiply-add with DIGIT_WEIGHTS followed by a
+// 16-bit multiply-add with PAIR_WEIGHTS leaves the value in the sum of the
+// two 32-bit halves of the lane.
+template <int Scale> struct BatchLayout;
+
+// Tens, units and tenths sit in bytes 4, 5 and 7
+template <> struct BatchLayout<1> {
+  static constexpr int64_t DIGIT_WEIGHTS = 0x01000a6400000000;
+  static constexpr int64_t PAIR_WEIGHTS = 0x0001000100010001;
+};
+
+// Tens, units, tenths and hundredths sit in bytes 3, 4, 6 and 7; tens and
+// units are weighted once more by the pair weights
+template <> struct BatchLayout<2> {
+  static constexpr int64_t DIGIT_WEIGHTS = 0x010a00010a000000;
+  static constexpr int64_t PAIR_WEIGHTS = 0x0001006400640000;
+};
+
+// Completes decoding one value from the classification of the 8 bytes before
+// its newline (bit 7 is the last byte) and the magnitude of its digits.
+// Returns the length of the value, or 0 like parse_value_backward.
+template <int Scale>
+inline size_t finish_value(const unsigned digit, const unsigned minus,
+                           const unsigned dot, const unsigned semicolon,
+                           Value magnitude, Value &value) {
+  // The decimals and the units must be digits, the tens may be
+  constexpr unsigned REQUIRED = (0xff << (8 - Scale) | 1 << (6 - Scale)) & 0xff;
+  if (!(dot >> (7 - Scale) & 1) || (digit & REQUIRED) != REQUIRED)
+    return 0;
+
+  size_t length = (digit >> (5 - Scale) & 1) ? Scale + 3 : Scale + 2;
+  if (minus >> (7 - length) & 1) {
+    magnitude = -magnitude;
+    ++length;
+  }
+  if (!(semicolon >> (7 - length) & 1))
+    return 0;
+
+  value = magnitude;
+  return length;
+}
+
+// Parses the values of a batch of rows of at least 8 bytes each. The digits
+// of several rows are converted at once: every row's last 8 bytes occupy a
+// 64-bit lane and multiply-adds with per-byte weights sum the digits. Scales
+// without a BatchLayout parse the rows one by one.
+#if defined(USE_AVX512)
+template <int Scale>
+void parse_values_batch(const std::array<std::string_view, PARSE_BATCH> &rows,
+                        std::array<Value, PARSE_BATCH> &values,
+                        std::array<size_t, PARSE_BATCH> &lengths) {
+  if constexpr (Scale == 0) {
+    for (size_t i = 0; i < PARSE_BATCH; ++i)
+      lengths[i] = parse_value_backward<Scale>(
+          rows[i].data() + rows[i].size(), values[i]);
+  } else {
+    constexpr size_t LANES = 8;
+    const __m512i digit_weights =
+        _mm512_set1_epi64(BatchLayout<Scale>::DIGIT_WEIGHTS);
+    const __m512i pair_weights =
+        _mm512_set1_epi64(BatchLayout<Scale>::PAIR_WEIGHTS);
+
+    for (size_t base = 0; base < PARSE_BATCH; base += LANES) {
+      const __m512i words = _mm512_set_epi64(
+          load_tail(rows[base + 7]), load_tail(rows[base + 6]),
+          load_tail(rows[base + 5]), load_tail(rows[base + 4]),
+          load_tail(rows[base + 3]), load_tail(rows[base + 2]),
+          load_tail(rows[base + 1]), load_tail(rows[base]));
+
+      const __m512i digits = _mm512_sub_epi8(words, _mm512_set1_epi8('0'));
+      const __mmask64 digit =
+          _mm512_cmple_epu8_mask(digits, _mm512_set1_epi8(9));
+      const __mmask64 minus =
+          _mm512_cmpeq_epi8_mask(words, _mm512_set1_epi8('-'));
+      const __mmask64 dot =
+          _mm512_cmpeq_epi8_mask(words, _mm512_set1_epi8('.'));
+      const __mmask64 semicolon =
+          _mm512_cmpeq_epi8_mask(words, _mm512_set1_epi8(';'));
+
+      const __m512i magnitude = _mm512_madd_epi16(
+          _mm512_maddubs_epi16(_mm512_maskz_mov_epi8(digit, digits),
+                               digit_weights),
+          pair_weights);
+      alignas(64) int32_t magnitudes[2 * LANES];
+      _mm512_store_si512(magnitudes, magnitude);
+
+      for (size_t i = 0; i < LANES; ++i) {
+        const int shift = 8 * i;
+        lengths[base + i] = finish_value<Scale>(
+            (digit >> shift) & 0xff, (minus >> shift) & 0xff,
+            (dot >> shift) & 0xff, (semicolon >> shift) & 0xff,
+            magnitudes[2 * i] + magnitudes[2 * i + 1], values[base + i]);
+      }
+    }
+  }
+}
+#elif defined(USE_AVX2)
+template <int Scale>
+void parse_values_batch(const std::array<std::string_view, PARSE_BATCH> &rows,
+                        std::array<Value, PARSE_BATCH> &values,
+                        std::array<size_t, PARSE_BATCH> &lengths) {
+  if constexpr (Scale == 0) {
+    for (size_t i = 0; i < PARSE_BATCH; ++i)
+      lengths[i] = parse_value_backward<Scale>(
+          rows[i].data() + rows[i].size(), values[i]);
+  } else {
+    constexpr size_t LANES = 4;
+    const __m256i digit_weights =
+        _mm256_set1_epi64x(BatchLayout<Scale>::DIGIT_WEIGHTS);
+    const __m256i pair_weights =
+        _mm256_set1_epi64x(BatchLayout<Scale>::PAIR_WEIGHTS);
+    const __m256i nine = _mm256_set1_epi8(9);
+
+    for (size_t base = 0; base < PARSE_BATCH; base += LANES) {
+      const __m256i words = _mm256_set_epi64x(
+          load_tail(rows[base + 3]), load_tail(rows[base + 2]),
+          load_tail(rows[base + 1]), load_tail(rows[base]));
+
+      const __m256i digits = _mm256_sub_epi8(words, _mm256_set1_epi8('0'));
+      const __m256i is_digit =
+          _mm256_cmpeq_epi8(_mm256_min_epu8(digits, nine), digits);
+      const uint32_t digit = _mm256_movemask_epi8(is_digit);
+      const uint32_t minus = Simd<32>::equal(words, Simd<32>::broadcast('-'));
+      const uint32_t dot = Simd<32>::equal(words, Simd<32>::broadcast('.'));
+      const uint32_t semicolon =
+          Simd<32>::equal(words, Simd<32>::broadcast(';'));
+
+      const __m256i magnitude = _mm256_madd_epi16(
+          _mm256_maddubs_epi16(_mm256_and_si256(digits, is_digit),
+                               digit_weights),
+          pair_weights);
+      alignas(32) int32_t magnitudes[2 * LANES];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(magnitudes), magnitude);
+
+      for (size_t i = 0; i < LANES; ++i) {
+        const int shift = 8 * i;
+        lengths[base + i] = finish_value<Scale>(
+            (digit >> shift) & 0xff, (minus >> shift) & 0xff,
+            (dot >> shift) & 0xff, (semicolon >> shift) & 0xff,
+            magnitudes[2 * i] + magnitudes[2 * i + 1], values[base + i]);
+      }
+    }
+  }
+}
+#else
+// SSE2 has no byte multiply-add, parse the rows one by one
+template <int Scale>
+void parse_values_batch(const std::array<std::string_view, PARSE_BATCH> &rows,
+                        std::array<Value, PARSE_BATCH> &values,
+                        std::array<size_t, PARSE_BATCH> &lengths) {
+  for (size_t i = 0; i < PARSE_BATCH; ++i)
+    lengths[i] = parse_value_backward<Scale>(rows[i].data() + rows[i].size(),
+                                             values[i]);
+}
+#endif
+
+template <unsigned Track, int Scale>
+void process_batch(const std::array<std::string_view, PARSE_BATCH> &rows,
+                   Aggregate &aggregate, RowTrace *trace) {
+  std::array<Value, PARSE_BATCH> values;
+  std::array<size_t, PARSE_BATCH> lengths;
+  parse_values_batch<Scale>(rows, values, lengths);
+
+  // Hash the whole batch and prefetch the slots before updating any of
+  // them, so that the cache misses of the batch overlap
+  std::array<std::string_view, PARSE_BATCH> names;
+  std::array<uint64_t, PARSE_BATCH> hashes;
+  for (size_t i = 0; i < PARSE_BATCH; ++i) {
+    if (lengths[i] == 0)
+      continue;
+    names[i] = rows[i].substr(0, rows[i].size() - lengths[i] - 1);
+    hashes[i] = hash_name(names[i]);
+    aggregate.stations.prefetch(hashes[i]);
+  }
+
+  for (size_t i = 0; i < PARSE_BATCH; ++i) {
+    if (lengths[i] == 0) {
+      process_line<Track, Scale>(rows[i], aggregate, trace);
+      continue;
+    }
+    note_row<Track>(trace,
+                    aggregate.stations.record<Track>(names[i], hashes[i],
+                                                     values[i], rows[i].data()),
+                    values[i]);
+  }
+}
+
+// Collects rows into batches for process_batch
+template <unsigned Track, int Scale> class RowBatcher {
+  std::array<std::string_view, PARSE_BATCH> rows;
+  size_t pending = 0;
+  Aggregate *aggregate = nullptr;
+  RowTrace *trace = nullptr;
+
+public:
+  RowBatcher() = default;
+  RowBatcher(Aggregate &aggregate, RowTrace *trace)
+      : aggregate(&aggregate), trace(trace) {}
+
+  void push(const std::string_view &row) {
+    // The batch parser loads 8 bytes back from the end of the row
+    if (row.size() < sizeof(uint64_t)) {
+      // Blank lines are skipped
+      if (row.empty())
+        return;
+      // Stations have to be noted in the order of the rows
+      if constexpr ((Track & TRACK_IDS) != 0)
+        flush();
+      process_line<Track, Scale>(row, *aggregate, trace);
+      return;
+    }
+
+    rows[pending++] = row;
+    if (pending == PARSE_BATCH) {
+      process_batch<Track, Scale>(rows, *aggregate, trace);
+      pending = 0;
+    }
+  }
+
+  void flush() {
+    for (size_t i = 0; i < pending; ++i)
+      process_line<Track, Scale>(rows[i], *aggregate, trace);
+    pending = 0;
+  }
+};
+
+// Scans `chunk` with up to MAX_CURSORS cursors over separate parts of it,
+// advancing them in lockstep. The rows of different cursors are
+// independent, which lets the core overlap their parsing, hashing and
+// updates instead of waiting on one row's dependency chain at a time.
+// With GENERIC_SCALE the rows skip the batched parse, which assumes the
+// spec layout and a scale with a kernel. With TRACK_IDS the stations of
+// the rows of each part go to its stream in `ids`. With TRACK_CHUNKS the
+// totals of the chunk are folded into the table once it is scanned.
+template <unsigned Track, bool ValidateUtf8, int Scale>
+void scan_chunk(const std::string_view &chunk, const ScanOptions &scan,
+                Aggregate &aggregate, ChunkIds *ids) {
+  constexpr int BATCH_SCALE = Scale == GENERIC_SCALE ? 1 : Scale;
+  std::array<RowCursor<ValidateUtf8>, MAX_CURSORS> cursor;
+  std::array<RowBatcher<Track, BATCH_SCALE>, MAX_CURSORS> batch;
+  std::array<RowTrace, MAX_CURSORS> trace{};
+  ChunkTotals *totals = nullptr;
+  if constexpr ((Track & TRACK_CHUNKS) != 0) {
+    // Too large for the stack, and only ever used by one chunk at a time
+    thread_local auto local = std::make_unique<ChunkTotals>();
+    totals = local.get();
+  }
+
+  size_t count = 0;
+  for (const auto &part : split_parts(chunk, scan.cursors)) {
+    if constexpr ((Track & TRACK_IDS) != 0)
+      trace[count].ids = &(*ids)[count];
+    trace[count].totals = totals;
+    cursor[count] = RowCursor<ValidateUtf8>(part, &aggregate.invalid_utf8);
+    batch[count] = RowBatcher<Track, BATCH_SCALE>(aggregate, &trace[count]);
+    ++count;
+  }
+
+  for (bool active = true; active;) {
+    active = false;
+    for (size_t i = 0; i < count; ++i) {
+      std::string_view row;
+      if (!cursor[i].next(row))
+        continue;
+      if constexpr (Scale == GENERIC_SCALE)
+        process_generic_line<Track>(row, scan, aggregate, &trace[i]);
+      else
+        batch[i].push(row);
+      active = true;
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i)
+    batch[i].flush();
+  if constexpr ((Track & TRACK_CHUNKS) != 0)
+    aggregate.stations.add_chunk(*totals);
+}
+
+// Picks the parse kernel for the scale of the values
+template <unsigned Track, bool ValidateUtf8>
+void scan_with_kernel(const std::string_view &chunk, const ScanOptions &scan,
+                      Aggregate &aggregate, ChunkIds *ids) {
+  const int scale = scan.columns.project ? GENERIC_SCALE : scan.scale;
+  if (scale == 0)
+    scan_chunk<Track, ValidateUtf8, 0>(chunk, scan, aggregate, ids);
+  else if (scale == 1)
+    scan_chunk<Track, ValidateUtf8, 1>(chunk, scan, aggregate, ids);
+  else if (scale == 2)
+    scan_chunk<Track, ValidateUtf8, 2>(chunk, scan, aggregate, ids);
+  else
+    scan_chunk<Track, ValidateUtf8, GENERIC_SCALE>(chunk, scan, aggregate,
+                                                   ids);
+}
+
+// Chunks that start after an error which ends the scan are not scanned;
+// those already running finish
+template <unsigned Track = 0>
+void process_chunk(const std::string_view &chunk, const ScanOptions &scan,
+                   Aggregate &aggregate, ChunkIds *ids = nullptr) {
+  if (aggregate.stations.full() ||
+      (scan.on_error == ErrorPolicy::Abort &&
+       aggregate.malformed_rows.count() != 0))
+    return;
+
+  if (scan.validate_utf8)
+    scan_with_kernel<Track, true>(chunk, scan, aggregate, ids);
+  else
+    scan_with_kernel<Track, false>(chunk, scan, aggregate, ids);
+}
+
+// Scans every chunk for the exact results. With TRACK_IDS the stations of
+// the rows of chunk i go to ids[i].
+template <unsigned Track>
+void scan_exact(const std::vector<std::string_view> &chunks,
+                const ScanOptions &scan, Aggregate &aggregate,
+                std::vector<ChunkIds> &ids) {
+  std::for_each(std::execution::par_unseq, chunks.begin(), chunks.end(),
+                [&](const std::string_view &chunk) {
+                  ChunkIds *chunk_ids = nullptr;
+                  if constexpr ((Track & TRACK_IDS) != 0)
+                    chunk_ids = &ids[&chunk - chunks.data()];
+                  process_chunk<Track>(chunk, scan, aggregate, chunk_ids);
+                });
+}
+
+// Values within [low, high] of each slot, in units of 10^-scale
+using OutlierBounds = std::vector<std::pair<double, double>>;
+
+// Counts the outliers among the rows of `part`, whose stations phase one
+// wrote to `ids`. Values are parsed the way phase one parsed them:
+// backwards from the end of the row, in batches with the kernel of the
+// scale, so the bytes of the names are not read. Projected rows find their
+// value field with split_row.
+template <int Scale>
+void count_part_outliers(const std::string_view &part,
+                         const std::vector<StationId> &ids,
+                         const ScanOptions &scan, const OutlierBounds &bounds,
+                         StationTable &table) {
+  const auto check = [&](const StationId id, const Value value) {
+    if (value < bounds[id].first || value > bounds[id].second)
+      table.count_outlier(id);
+  };
+  // Rows the batch kernel does not take, like process_line
+  const auto check_row = [&](const std::string_view &row, const StationId id) {
+    Value value = 0;
+    if constexpr (Scale == GENERIC_SCALE) {
+      std::string_view name;
+      std::string_view text;
+      if (!split_row(row, scan.columns, name, text) ||
+          !parse_fixed(text, scan.scale, value))
+        return;
+    } else if (row.size() < sizeof(uint64_t) ||
+               parse_value_backward<Scale>(row.data() + row.size(), value) ==
+                   0) {
+      const size_t pos = row.find(';');
+      if (pos == std::string_view::npos ||
+          !parse_fixed(row.substr(pos + 1), Scale, value))
+        return;
+    }
+    check(id, value);
+  };
+
+  std::array<std::string_view, PARSE_BATCH> rows;
+  std::array<StationId, PARSE_BATCH> row_ids;
+  size_t pending = 0;
+  const auto flush = [&] {
+    if constexpr (Scale != GENERIC_SCALE) {
+      std::array<Value, PARSE_BATCH> values;
+      std::array<size_t, PARSE_BATCH> lengths;
+      parse_values_batch<Scale>(rows, values, lengths);
+      for (size_t i = 0; i < PARSE_BATCH; ++i) {
+        if (lengths[i] != 0)
+          check(row_ids[i], values[i]);
+        else
+          check_row(rows[i], row_ids[i]);
+      }
+    }
+    pending = 0;
+  };
+
+  // Blank rows have no station, like in phase one
+  RowCursor<false> cursor(part, nullptr);
+  std::string_view row;
+  for (size_t next = 0; next < ids.size() && cursor.next(row);) {
+    if (row.empty())
+      continue;
+    const StationId id = ids[next++];
+    if (id == NO_STATION)
+      continue;
+    // The batch kernel loads 8 bytes back from the end of the row
+    if (Scale == GENERIC_SCALE || row.size() < sizeof(uint64_t)) {
+      check_row(row, id);
+      continue;
+    }
+    rows[pending] = row;
+    row_ids[pending] = id;
+    if (++pending == PARSE_BATCH)
+      flush();
+  }
+  for (size_t i = 0; i < pending; ++i)
+    check_row(rows[i], row_ids[i]);
+}
+
+// Second pass of --outliers: counts the rows of every station whose value
+// is more than `k` standard deviations from its mean. It splits the chunks
+// of the first pass into the same parts, whose rows' stations the first
+// pass wrote to `ids`, so no name is hashed or compared again. The chunks
+// were just read and are still in the page cache.
+void count_outliers(const std::vector<std::string_view> &chunks,
+                    const std::vector<ChunkIds> &ids, const ScanOptions &scan,
+                    const double k, StationTable &table) {
+  OutlierBounds bounds(TABLE_SIZE);
+  for (size_t id = 0; id < TABLE_SIZE; ++id) {
+    const StationData &station = table.at(static_cast<StationId>(id));
+    if (station.count == 0)
+      continue;
+    const auto count = static_cast<double>(station.count);
+    const double mean = station.sum / count;
+    const auto sum_sq =
+        static_cast<double>(table.sum_of_squares(static_cast<StationId>(id)));
+    const double deviation =
+        std::sqrt(std::max(0.0, sum_sq / count - mean * mean));
+    bounds[id] = {mean - k * deviation, mean + k * deviation};
+  }
+
+  const int scale = scan.columns.project ? GENERIC_SCALE : scan.scale;
+  std::for_each(
+      std::execution::par_unseq, chunks.begin(), chunks.end(),
+      [&](const std::string_view &chunk) {
+        const ChunkIds &chunk_ids = ids[&chunk - chunks.data()];
+        for (size_t i = 0; const auto &part : split_parts(chunk, scan.cursors)) {
+          const auto &part_ids = chunk_ids[i++];
+          if (scale == 0)
+            count_part_outliers<0>(part, part_ids, scan, bounds, table);
+          else if (scale == 1)
+            count_part_outliers<1>(part, part_ids, scan, bounds, table);
+          else if (scale == 2)
+            count_part_outliers<2>(part, part_ids, scan, bounds, table);
+          else
+            count_part_outliers<GENERIC_SCALE>(part, part_ids, scan, bounds,
+                                               table);
+        }
+      });
+}
+
+// Picks random chunks until they cover `fraction` of the total size
+std::vector<std::string_view>
+sample_chunks(std::vector<std::string_view> chunks, const double fraction,
+              const uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::shuffle(chunks.begin(), chunks.end(), rng);
+
+  size_t total = 0;
+  for (const auto &chunk : chunks)
+    total += chunk.size();
+
+  const auto target = static_cast<size_t>(std::ceil(fraction * total));
+  size_t covered = 0;
+  size_t taken = 0;
+  while (taken < chunks.size() && covered < target)
+    covered += chunks[taken++].size();
+  chunks.resize(taken);
+  return chunks;
+}
+
+// Prints estimated means with a 95% confidence interval. Rows in a chunk
+// are not independent, the sampled units are the chunks: the mean is the
+// ratio of the station's sum to its rows over the chunks scanned, and its
+// variance that of a ratio estimator across those chunks, with a finite
+// population correction. Min and max are those of the sampled rows, so the
+// true min is at most and the true max at least that value.
+void print_sampled_results(const StationTable &table, const double fraction,
+                           const int scale) {
+  constexpr double Z_95 = 1.96;
+  const auto chunks = static_cast<long double>(table.chunks_added());
+  const long double spread =
+      std::max(0.0, 1.0 - fraction) * chunks / (chunks - 1);
+  const auto unit = static_cast<double>(POW10[scale]);
+
+  std::cout << std::fixed << std::setprecision(std::max(scale, 1)) << "{";
+  for (size_t i = 0; const StationData *it : table.sorted()) {
+    const StationData &station = *it;
+    // In units of 10^-scale
+    const auto count = static_cast<long double>(station.count);
+    const long double mean = station.sum / count;
+    // Squared deviations of the chunk sums from the mean times their rows
+    const auto [xx, xy, yy] = table.sums_over_chunks(station);
+    const long double deviations =
+        std::max<long double>(0, yy - 2 * mean * xy + mean * mean * xx);
+    // One chunk says nothing about the spread between chunks
+    const double margin =
+        chunks < 2 ? std::numeric_limits<double>::infinity()
+                   : static_cast<double>(Z_95 * std::sqrt(spread * deviations) /
+                                         count);
+
+    if (i != 0)
+      std::cout << ", ";
+    std::cout << station.name << "=≤" << station.min / unit << "/≥"
+              << station.max / unit << '/' << mean / unit << "±"
+              << margin / unit;
+    ++i;
+  }
+  std::cout << "}" << std::endl;
+}
+
+// Scans `chunks` in random order and prints an estimate every `interval`
+// until the scan completes, so the first answer does not wait for the
+// whole file
+void scan_progressive(std::vector<std::string_view> chunks,
+                      const std::chrono::milliseconds interval,
+                      const uint64_t seed, const ScanOptions &scan,
+                      Aggregate &aggregate) {
+  // Sampling everything just shuffles the chunks
+  chunks = sample_chunks(std::move(chunks), 1.0, seed);
+  size_t total = 0;
+  for (const auto &chunk : chunks)
+    total += chunk.size();
+
+  std::atomic<size_t> scanned = 0;
+  auto done = std::async(std::launch::async, [&] {
+    std::for_each(std::execution::par_unseq, chunks.begin(), chunks.end(),
+                  [&](std::string_view chunk) {
+                    process_chunk<TRACK_CHUNKS>(chunk, scan, aggregate);
+                    scanned.fetch_add(chunk.size(), std::memory_order_relaxed);
+                  });
+  });
+
+  while (done.wait_for(interval) != std::future_status::ready) {
+    const double fraction =
+        static_cast<double>(scanned.load(std::memory_order_relaxed)) /
+        std::max<size_t>(total, 1);
+    std::cout << std::fixed << std::setprecision(1) << "Scanned "
+              << fraction * 100 << "%: ";
+    print_sampled_results(aggregate.stations, fraction, scan.scale);
+  }
+  done.get();
+}
+
+// Scans `chunks` in random order until `deadline` and returns the number of
+// bytes covered. A chunk is only started if it is expected to finish in
+// time, judging by the slowest chunk seen so far.
+size_t scan_until(std::vector<std::string_view> chunks,
+                  const std::chrono::steady_clock::time_point deadline,
+                  const uint64_t seed, const ScanOptions &scan,
+                  Aggregate &aggregate) {
+  using clock = std::chrono::steady_clock;
+  chunks = sample_chunks(std::move(chunks), 1.0, seed);
+
+  std::atomic<size_t> scanned = 0;
+  std::atomic<clock::rep> slowest = 0;
+  std::for_each(
+      std::execution::par_unseq, chunks.begin(), chunks.end(),
+      [&](std::string_view chunk) {
+        const auto started = clock::now();
+        if (started + clock::duration(slowest.load()) >= deadline)
+          return;
+
+        process_chunk<TRACK_CHUNKS>(chunk, scan, aggregate);
+        scanned.fetch_add(chunk.size(), std::memory_order_relaxed);
+
+        const auto took = (clock::now() - started).count();
+        auto prev = slowest.load();
+        while (took > prev && !slowest.compare_exchange_weak(prev, took)) {
+        }
+      });
+  return scanned;
+}
+
+// Finalizer of SplitMix64
+constexpr uint64_t mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// Hash of a station's name and exact totals. FNV-1a over the name keeps it
+// the same for every build and host.
+uint64_t entry_checksum(const StationData &station) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const unsigned char c : station.name)
+    hash = (hash ^ c) * 0x100000001b3;
+  for (const uint64_t field :
+       {static_cast<uint64_t>(station.count),
+        static_cast<uint64_t>(station.sum.load()),
+        static_cast<uint64_t>(station.min.load()),
+        static_cast<uint64_t>(station.max.load())})
+    hash = mix(hash ^ field);
+  return hash;
+}
+
+// Attributes of stations, read from a delimited file whose header row
+// names them after the station name column. Fields are split on the first
+// of ';', ',' or tab in the header row; quoting is not supported. Stations
+// are looked up with the hash and comparison of the aggregation table.
+class StationMetadata {
+  struct NameHash {
+    size_t operator()(const std::string_view &name) const {
+      return hash_name(name);
+    }
+  };
+  struct NameEqual {
+    bool operator()(const std::string_view &a,
+                    const std::string_view &b) const {
+      return names_equal(a, b);
+    }
+  };
+
+  MappedFile file;
+  std::vector<std::string_view> names;
+  // Attribute values of each station, in the order of `names`
+  std::unordered_map<std::string_view, std::vector<std::string_view>,
+                     NameHash, NameEqual>
+      rows;
+
+  static std::vector<std::string_view> split(std::string_view row,
+                                             const char delimiter) {
+    std::vector<std::string_view> fields;
+    for (size_t pos; (pos = row.find(delimiter)) != std::string_view::npos;
+         row.remove_prefix(pos + 1))
+      fields.push_back(row.substr(0, pos));
+    fields.push_back(row);
+    return fields;
+  }
+
+public:
+  explicit StationMetadata(const std::string &path) : file(path) {
+    std::string_view data(file.data(), file.size());
+    constexpr std::string_view BOM = "\xEF\xBB\xBF";
+    if (data.starts_with(BOM))
+      data.remove_prefix(BOM.size());
+
+    char delimiter = 0;
+    for (bool header = true; !data.empty(); header = false) {
+      const size_t newline = data.find('\n');
+      std::string_view row = data.substr(0, newline);
+      data.remove_prefix(std::min(data.size(), newline + 1));
+      if (row.ends_with('\r'))
+        row.remove_suffix(1);
+
+      if (header) {
+        const size_t pos = row.find_first_of(";,\t");
+        if (pos == std::string_view::npos)
+          throw std::runtime_error(
+              "Station metadata needs a header row naming the attributes");
+        delimiter = row[pos];
+        names = split(row, delimiter);
+        names.erase(names.begin());
+        continue;
+      }
+      if (row.empty())
+        continue;
+
+      auto fields = split(row, delimiter);
+      if (fields.size() != names.size() + 1)
+        throw std::runtime_error("Station metadata row has " +
+                                 std::to_string(fields.size()) +
+                                 " fields, expected " +
+                                 std::to_string(names.size() + 1) + ": '" +
+                                 std::string(row) + "'");
+      const std::string_view station = fields.front();
+      fields.erase(fields.begin());
+      if (!rows.emplace(station, std::move(fields)).second)
+        throw std::runtime_error("Station metadata lists '" +
+                                 std::string(station) + "' twice");
+    }
+  }
+
+  // Position of attribute `name` in the values of a station
+  [[nodiscard]] size_t attribute(const std::string_view &name) const {
+    const auto it = std::find(names.begin(), names.end(), name);
+    if (it == names.end())
+      throw std::runtime_error("Station metadata has no attribute '" +
+                               std::string(name) + "'");
+    return it - names.begin();
+  }
+
+  [[nodiscard]] const std::vector<std::string_view> &attributes() const {
+    return names;
+  }
+
+  // Attribute values of `station`, nullptr if the file does not list it
+  [[nodiscard]] const std::vector<std::string_view> *
+  find(const std::string_view &station) const {
+    const auto it = rows.find(station);
+    return it == rows.end() ? nullptr : &it->second;
+  }
+};
+
+// Prints min/max/mean of `station` in units of `unit`
+template <typename Stats>
+void print_stats(std::ostream &out, const Stats &station, const double unit) {
+  out << station.min / unit << '/' << station.max / unit << '/'
+      << static_cast<double>(station.sum) / station.count / unit;
+}
+
+// Checksum of the results: the entries' hashes are summed, so it does not
+// depend on the order stations are merged or printed in
+uint64_t results_checksum(const std::vector<const StationData *> &stations,
+                          const int scale) {
+  uint64_t checksum = 0;
+  for (const StationData *station : stations)
+    checksum += entry_checksum(*station);
+  // Totals at different scales are different results
+  return mix(checksum ^ static_cast<uint64_t>(scale));
+}
+
+// What print_results lists beside the statistics of each station
+struct Annotations {
+  // Attributes joined from --metadata, after the name
+  const StationMetadata *metadata = nullptr;
+  // File the rows of the min and max are in, whose byte offsets follow
+  // those values with --locate-extremes, and the table that located them
+  const MappedFile *extremes = nullptr;
+  const StationTable *located = nullptr;
+};
+
+// Prints values with `scale` decimals, and at least one
+void print_results(const std::vector<const StationData *> &stations,
+                   const int scale, std::ostream &out = std::cout,
+                   const Annotations &annotations = {}) {
+  const StationMetadata *metadata = annotations.metadata;
+  const MappedFile *file = annotations.extremes;
+  const auto unit = static_cast<double>(POW10[scale]);
+  out << std::fixed << std::setprecision(std::max(scale, 1)) << "{";
+  for (size_t i = 0; const StationData *it : stations) {
+    const StationData &station = *it;
+    if (i != 0)
+      out << ", ";
+    out << station.name;
+    if (const auto *values = metadata ? metadata->find(station.name) : nullptr) {
+      out << '[';
+      for (size_t j = 0; j < values->size(); ++j)
+        out << (j == 0 ? "" : ";") << metadata->attributes()[j] << '='
+            << (*values)[j];
+      out << ']';
+    }
+    out << '=';
+    if (file != nullptr) {
+      const auto offset = [&](const char *row) {
+        return row - file->data() + file->offset();
+      };
+      const ExtremeRows &rows = annotations.located->rows_of(station);
+      out << station.min / unit << '@' << offset(rows.min_at) << '/'
+          << station.max / unit << '@' << offset(rows.max_at) << '/'
+          << static_cast<double>(station.sum) / station.count / unit;
+    } else {
+      print_stats(out, station, unit);
+    }
+    ++i;
+  }
+  out << "}" << std::endl;
+}
+
+// Stations of `stations` that meet every --where condition
+std::vector<const StationData *>
+filter_stations(const std::vector<const StationData *> &stations,
+                const StationMetadata &metadata, const Options &options) {
+  std::vector<std::pair<size_t, std::string_view>> conditions;
+  for (const auto &[name, value] : options.where)
+    conditions.emplace_back(metadata.attribute(name), value);
+
+  std::vector<const StationData *> selected;
+  for (const StationData *station : stations) {
+    const auto *values = metadata.find(station->name);
+    if (std::all_of(conditions.begin(), conditions.end(),
+                    [&](const auto &condition) {
+                      return values != nullptr &&
+                             (*values)[condition.first] == condition.second;
+                    }))
+      selected.push_back(station);
+  }
+  return selected;
+}
+
+// Prints one line of results per value of the --group-by attribute, in
+// order. Stations the metadata does not list are in the empty group.
+void print_grouped_results(const std::vector<const StationData *> &stations,
+                           const Annotations &annotations,
+                           const Options &options, std::ostream &out) {
+  const StationMetadata &metadata = *annotations.metadata;
+  const size_t attribute = metadata.attribute(options.group_by);
+  const auto group_of = [&](const StationData *station) {
+    const auto *values = metadata.find(station->name);
+    return values == nullptr ? std::string_view() : (*values)[attribute];
+  };
+  // Stable, so the stations of a group stay ordered by name
+  auto grouped = stations;
+  std::stable_sort(grouped.begin(), grouped.end(),
+                   [&](const StationData *a, const StationData *b) {
+                     return group_of(a) < group_of(b);
+                   });
+  for (auto first = grouped.begin(); first != grouped.end();) {
+    const auto last =
+        std::find_if(first, grouped.end(), [&](const StationData *station) {
+          return group_of(station) != group_of(*first);
+        });
+    out << group_of(*first) << '=';
+    print_results({first, last}, options.scan.scale, out, annotations);
+    first = last;
+  }
+}
+
+// Prints how many readings of each station --outliers counted
+void print_outliers(const std::vector<const StationData *> &stations,
+                    const StationTable &table, const double k,
+                    std::ostream &out) {
+  out << "Outliers beyond " << std::defaultfloat << std::setprecision(6) << k
+      << " sigma: {";
+  for (size_t i = 0; const StationData *station : stations) {
+    if (i++ != 0)
+      out << ", ";
+    out << station->name << '=' << table.outliers_of(*station);
+  }
+  out << "}" << std::endl;
+}
+
+// Totals of a group of stations. The sum is wide enough that adding up
+// the sums of every station in the table cannot overflow.
+struct Rollup {
+  uint64_t count = 0;
+  __int128 sum = 0;
+  Value min = std::numeric_limits<Value>::max();
+  Value max = std::numeric_limits<Value>::lowest();
+};
+
+// Group of `name` under `key`. Prefixes count UTF-8 characters, not bytes,
+// so they never split one; names without `separator` are their own group.
+std::string_view rollup_group(const std::string_view &name,
+                              const RollupKey &key,
+                              const StationMetadata *metadata,
+                              const size_t attribute) {
+  switch (key.kind) {
+  case RollupKey::Kind::Prefix: {
+    size_t end = 0;
+    for (size_t characters = 0; end < name.size(); ++end) {
+      // Continuation bytes do not start a character
+      if ((name[end] & 0xC0) != 0x80 && characters++ == key.length)
+        break;
+    }
+    return name.substr(0, end);
+  }
+  case RollupKey::Kind::Before:
+    return name.substr(0, name.find(key.separator));
+  case RollupKey::Kind::Attribute:
+    break;
+  }
+  const auto *values = metadata->find(name);
+  return values == nullptr ? std::string_view() : (*values)[attribute];
+}
+
+// Prints, for every --rollup key, the totals of the groups of `stations`
+// under it on one line. The groups are merged from the per-station totals,
+// so any number of keys costs no more than one scan.
+void print_rollups(const std::vector<const StationData *> &stations,
+                   const Options &options, const StationMetadata *metadata,
+                   std::ostream &out) {
+  const auto unit = static_cast<double>(POW10[options.scan.scale]);
+  for (const RollupKey &key : options.rollups) {
+    const size_t attribute = key.kind == RollupKey::Kind::Attribute
+                                 ? metadata->attribute(key.attribute)
+                                 : 0;
+    std::map<std::string_view, Rollup> groups;
+    for (const StationData *station : stations) {
+      Rollup &group =
+          groups[rollup_group(station->name, key, metadata, attribute)];
+      group.count += station->count;
+      group.sum += station->sum;
+      group.min = std::min(group.min, station->min.load());
+      group.max = std::max(group.max, station->max.load());
+    }
+
+    out << key.spec << "={";
+    for (size_t i = 0; const auto &[name, group] : groups) {
+      if (i++ != 0)
+        out << ", ";
+      out << name << '=';
+      print_stats(out, group, unit);
+    }
+    out << "}" << std::endl;
+  }
+}
+
+// First line of the totals printed with --partial
+constexpr std::string_view PARTIAL_MAGIC = "1brc-partial";
+
+// Prints the exact totals of every station, one `name;count;sum;min;max`
+// row each in units of 10^-scale, after a line naming the scale. diff
+// reads them back with load_partial.
+void print_partial(const StationTable &table, const int scale,
+                   std::ostream &out) {
+  out << PARTIAL_MAGIC << " scale=" << scale << '\n';
+  for (const StationData *it : table.sorted()) {
+    const StationData &station = *it;
+    out << station.name << ';' << station.count << ';' << station.sum << ';'
+        << station.min << ';' << station.max << '\n';
+  }
+  out << std::flush;
+}
+
+// Merges totals printed by print_partial into `table`. The names point
+// into `contents`, which has to outlive the table.
+void load_partial(std::string_view contents, StationTable &table,
+                  const int scale) {
+  const size_t newline = contents.find('\n');
+  const std::string_view header = contents.substr(0, newline);
+  const std::string expected =
+      std::string(PARTIAL_MAGIC) + " scale=" + std::to_string(scale);
+  if (header != expected)
+    throw std::runtime_error("Partial totals are '" + std::string(header) +
+                             "', expected '" + expected + "'");
+  contents.remove_prefix(std::min(contents.size(), newline + 1));
+
+  while (!contents.empty()) {
+    const size_t end = contents.find('\n');
+    std::string_view row = contents.substr(0, end);
+    contents.remove_prefix(std::min(contents.size(), end + 1));
+    if (row.empty())
+      continue;
+
+    // Split from the end: names of projected files may contain ';'
+    const auto field = [&](auto &result) {
+      const size_t pos = row.rfind(';');
+      const std::string_view text =
+          row.substr(pos == std::string_view::npos ? 0 : pos + 1);
+      auto [ptr, ec] =
+          std::from_chars(text.data(), text.data() + text.size(), result);
+      if (pos == std::string_view::npos || ec != std::errc() ||
+          ptr != text.data() + text.size())
+        return false;
+      row = row.substr(0, pos);
+      return true;
+    };
+    uint64_t count = 0;
+    int64_t sum = 0;
+    Value min = 0;
+    Value max = 0;
+    const std::string_view line = row;
+    if (!field(max) || !field(min) || !field(sum) || !field(count) ||
+        count == 0 || min > max)
+      throw std::runtime_error("Malformed partial totals: '" +
+                               std::string(line) + "'");
+    table.merge(row, count, sum, min, max);
+  }
+}
+
+// Prints stations only in `before` with '-', those only in `after` with
+// '+' and those whose min, max or mean moved by more than `threshold` with
+// '~', ordered by name. Counts of each go to stderr.
+void print_diff(const StationTable &before, const StationTable &after,
+                const int scale, const double threshold) {
+  const auto unit = static_cast<double>(POW10[scale]);
+  // In units of 10^-scale, like the totals
+  const double limit = threshold * unit;
+  const auto moved = [&](const double from, const double to) {
+    return std::abs(to - from) > limit;
+  };
+
+  const auto old_stations = before.sorted();
+  const auto new_stations = after.sorted();
+  size_t removed = 0;
+  size_t added = 0;
+  size_t changed = 0;
+  std::cout << std::fixed << std::setprecision(std::max(scale, 1));
+  for (size_t i = 0, j = 0;
+       i < old_stations.size() || j < new_stations.size();) {
+    const StationData *from = i < old_stations.size() ? old_stations[i] : nullptr;
+    const StationData *to = j < new_stations.size() ? new_stations[j] : nullptr;
+    if (to == nullptr || (from != nullptr && from->name < to->name)) {
+      std::cout << "- " << from->name << '=';
+      print_stats(std::cout, *from, unit);
+      std::cout << '\n';
+      ++removed;
+      ++i;
+      continue;
+    }
+    if (from == nullptr || to->name < from->name) {
+      std::cout << "+ " << to->name << '=';
+      print_stats(std::cout, *to, unit);
+      std::cout << '\n';
+      ++added;
+      ++j;
+      continue;
+    }
+
+    if (moved(from->min, to->min) || moved(from->max, to->max) ||
+        moved(static_cast<double>(from->sum) / from->count,
+              static_cast<double>(to->sum) / to->count)) {
+      std::cout << "~ " << from->name << '=';
+      print_stats(std::cout, *from, unit);
+      std::cout << " -> ";
+      print_stats(std::cout, *to, unit);
+      std::cout << '\n';
+      ++changed;
+    }
+    ++i;
+    ++j;
+  }
+  std::cout << std::flush;
+  std::cerr << "Removed " << removed << ", added " << added << ", changed "
+            << changed << " stations" << std::endl;
+}
+
+// On-disk cache of printed results. An entry is named after the input
+// file and every option that affects the output, and its first line also
+// records the size and modification time of the file. Changing the query
+// misses the cache, and modifying the file misses the entry and replaces
+// it once the results are stored, rather than leaving it behind.
+class ResultCache {
+  std::string key;
+  std::filesystem::path entry;
+
+public:
+  ResultCache(const std::filesystem::path &dir, const Options &options) {
+    struct stat sb;
+    if (stat(options.path.c_str(), &sb) == -1) {
+      throw std::runtime_error("Failed to stat file");
+    }
+
+    std::ostringstream oss;
+    oss << "1brc " << ENGINE_VERSION << " dev=" << sb.st_dev
+        << " ino=" << sb.st_ino << " offset=" << options.offset << " length=" << options.length
+        << " first_row=" << options.first_row
+        << " row_count=" << options.row_count
+        << " header=" << static_cast<int>(options.header)
+        << " scale=" << options.scan.scale
+        << " checksum=" << options.checksum
+        << " partial=" << options.partial;
+    for (const RollupKey &rollup : options.rollups)
+      oss << " rollup=" << rollup.spec;
+    oss << " locate_extremes=" << options.locate_extremes
+        << " outliers=" << options.outliers;
+    if (options.scan.columns.project)
+      oss << " delimiter=" << static_cast<int>(options.scan.columns.delimiter)
+          << " columns=" << options.scan.columns.name << ','
+          << options.scan.columns.value;
+    const std::string query = oss.str();
+
+    oss.str("");
+    oss << std::hex << std::setw(16) << std::setfill('0')
+        << std::hash<std::string>{}(query);
+    entry = dir / oss.str();
+
+    oss.str("");
+    oss << std::dec << query << " size=" << sb.st_size << " mtime=" << sb.st_mtim.tv_sec
+        << '.' << sb.st_mtim.tv_nsec;
+    key = oss.str();
+  }
+
+  [[nodiscard]] std::optional<std::string> load() const {
+    std::ifstream in(entry, std::ios::binary);
+    std::string stored;
+    if (!std::getline(in, stored) || stored != key)
+      return std::nullopt;
+    return std::string(std::istreambuf_iterator<char>(in), {});
+  }
+
+  // Failing to store is not an error, the result is just not cached
+  void store(const std::string &output) const {
+    std::error_code ec;
+    std::filesystem::create_directories(entry.parent_path(), ec);
+
+    // Write to a temporary file first so that readers never see a
+    // partially written entry
+    auto tmp = entry;
+    tmp += ".tmp" + std::to_string(getpid());
+    {
+      std::ofstream out(tmp, std::ios::binary);
+      out << key << '\n' << output;
+      if (!out) {
+        std::cerr << "Warning: failed to write cache entry " << tmp
+                  << std::endl;
+        std::filesystem::remove(tmp, ec);
+        return;
+      }
+    }
+    std::filesystem::rename(tmp, entry, ec);
+    if (ec) {
+      std::cerr << "Warning: failed to write cache entry " << entry << ": "
+                << ec.message() << std::endl;
+      std::filesystem::remove(tmp, ec);
+    }
+  }
+};
+
+// Whether the first row of `data` is a header: it is if its value field
+// does not start like a number
+bool starts_with_header(const std::string_view &data, const Columns &columns) {
+  std::string_view row = data.substr(0, data.find('\n'));
+  if (row.ends_with('\r'))
+    row.remove_suffix(1);
+
+  std::string_view name;
+  std::string_view value;
+  if (!split_row(row, columns, name, value))
+    return true;
+  if (value.starts_with('-'))
+    value.remove_prefix(1);
+  return value.empty() || static_cast<unsigned>(value[0] - '0') > 9;
+}
+
+// Lists the rows starting at `positions` with their offsets in the file
+void print_rows(const std::vector<const char *> &positions,
+                const MappedFile &file) {
+  const char *end = file.data() + file.size();
+  for (const char *position : positions) {
+    const char *row_end =
+        std::find(position, std::min(position + MAX_ROW_LENGTH, end), '\n');
+    std::cerr << "  " << position - file.data() + file.offset() << ": "
+              << std::string_view(position, row_end) << '\n';
+  }
+  std::cerr << std::flush;
+}
+
+// Rows of `file` to scan: without a byte order mark, a header row and the
+// rows outside --first-row and --row-count
+std::string_view select_input(const MappedFile &file, const Options &options) {
+  std::string_view data(file.data(), file.size());
+  // Byte order mark at the start of the file
+  constexpr std::string_view BOM = "\xEF\xBB\xBF";
+  if (file.offset() == 0 && data.starts_with(BOM))
+    data.remove_prefix(BOM.size());
+  if (file.offset() == 0 && !data.empty() &&
+      (options.header == Header::Yes ||
+       (options.header == Header::Auto &&
+        starts_with_header(data, options.scan.columns)))) {
+    const size_t newline = data.find('\n');
+    data.remove_prefix(newline == std::string_view::npos ? data.size()
+                                                         : newline + 1);
+  }
+  return select_rows(data, options.first_row, options.row_count);
+}
+
+// Reports the problems the scan of `file` ran into, each line starting
+// with `source`. Returns false if they leave no results to print.
+bool report_problems(const Aggregate &aggregate, const MappedFile &file,
+                     const ScanOptions &scan, const std::string &source = "") {
+  if (aggregate.stations.full()) {
+    std::cerr << source << "Error: more than " << TABLE_SIZE
+              << " distinct stations" << std::endl;
+    return false;
+  }
+  bool overflowed = false;
+  for (const StationData *station : aggregate.stations.sorted()) {
+    if (!station->overflowed)
+      continue;
+    std::cerr << source << "Error: sum of values overflowed for "
+              << station->name << std::endl;
+    overflowed = true;
+  }
+  if (overflowed)
+    return false;
+
+  const size_t malformed = aggregate.malformed_rows.count();
+  switch (malformed == 0 ? ErrorPolicy::Count : scan.on_error) {
+  case ErrorPolicy::Abort:
+    std::cerr << source << "Error: malformed rows, first at byte offsets:\n";
+    print_rows(aggregate.malformed_rows.first(), file);
+    return false;
+  case ErrorPolicy::Skip:
+    std::cerr << source << "Warning: skipped " << malformed
+              << " malformed rows, first at byte offsets:\n";
+    print_rows(aggregate.malformed_rows.first(), file);
+    break;
+  case ErrorPolicy::Count:
+    if (malformed != 0)
+      std::cerr << source << "Warning: skipped " << malformed
+                << " malformed rows\n";
+    break;
+  }
+
+  if (aggregate.invalid_utf8.count() > 0) {
+    std::cerr << source << "Invalid UTF-8: " << aggregate.invalid_utf8.count()
+              << " sequences, first at byte offsets";
+    for (const char *position : aggregate.invalid_utf8.first())
+      std::cerr << ' ' << position - file.data() + file.offset();
+    std::cerr << std::endl;
+  }
+  return true;
+}
+
+// Aggregates both inputs of diff and prints how they differ. Inputs
+// written with --partial are loaded instead of scanned.
+int run_diff(const Options &options) {
+  const std::array<std::string, 2> paths{options.path, options.other_path};
+  std::array<MappedFile, 2> files;
+  std::array<std::unique_ptr<Aggregate>, 2> aggregates;
+  std::vector<std::pair<std::string_view, Aggregate *>> tasks;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    aggregates[i] = std::make_unique<Aggregate>();
+    try {
+      files[i] = MappedFile{paths[i]};
+      if (std::string_view(files[i].data(), files[i].size())
+              .starts_with(PARTIAL_MAGIC)) {
+        load_partial({files[i].data(), files[i].size()},
+                     aggregates[i]->stations, options.scan.scale);
+        continue;
+      }
+    } catch (const std::exception &e) {
+      std::cerr << paths[i] << ": " << e.what() << std::endl;
+      return 1;
+    }
+    for (const auto &chunk :
+         split_into_chunks(select_input(files[i], options), CHUNK_SIZE))
+      tasks.emplace_back(chunk, aggregates[i].get());
+  }
+
+  // Chunks of both inputs go through one loop, so the scans share the
+  // worker pool instead of one waiting for the other
+  std::for_each(std::execution::par_unseq, tasks.begin(), tasks.end(),
+                [&](const std::pair<std::string_view, Aggregate *> &task) {
+                  process_chunk(task.first, options.scan, *task.second);
+                });
+
+  bool ok = true;
+  for (size_t i = 0; i < paths.size(); ++i)
+    ok &= report_problems(*aggregates[i], files[i], options.scan,
+                          paths[i] + ": ");
+  if (!ok)
+    return 1;
+  print_diff(aggregates[0]->stations, aggregates[1]->stations,
+             options.scan.scale, options.threshold);
+  return 0;
+}
+
+} // namespace
+
+// Scans the input of `options` and prints the results, timing deadlines
+// from `started`
+int run(const Options &options,
+        const std::chrono::steady_clock::time_point started) {
+  if (options.diff)
+    return run_diff(options);
+
+  // Loaded before the scan so that a bad file or attribute fails fast
+  std::optional<StationMetadata> metadata;
+  if (!options.metadata.empty()) {
+    try {
+      metadata.emplace(options.metadata);
+      for (const auto &condition : options.where)
+        (void)metadata->attribute(condition.first);
+      if (!options.group_by.empty())
+        (void)metadata->attribute(options.group_by);
+      for (const RollupKey &key : options.rollups) {
+        if (key.kind == RollupKey::Kind::Attribute)
+          (void)metadata->attribute(key.attribute);
+      }
+    } catch (const std::exception &e) {
+      std::cerr << options.metadata << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // Only exact results are cached, and a cache hit would skip validation.
+  // The key does not cover the metadata file, so joined results are not.
+  std::optional<ResultCache> cache;
+  if (!options.cache_dir.empty() && options.sample == 1.0 &&
+      options.deadline == 0 && options.progress_interval == 0 &&
+      !options.scan.validate_utf8 && !metadata) {
+    try {
+      cache.emplace(options.cache_dir, options);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    if (auto cached = cache->load()) {
+      std::cout << *cached << std::flush;
+      return 0;
+    }
+  }
+
+  MappedFile file;
+  try {
+    file = MappedFile{options.path, options.offset, options.length};
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  auto aggregate = std::make_unique<Aggregate>();
+  std::string_view region = select_input(file, options);
+  auto chunks = split_into_chunks(region, CHUNK_SIZE);
+  // Part of the region the results are based on
+  size_t covered = region.size();
+  if (options.sample < 1.0) {
+    chunks = sample_chunks(std::move(chunks), options.sample, options.seed);
+    covered = 0;
+    for (const auto &chunk : chunks)
+      covered += chunk.size();
+    std::cerr << "Sampled " << covered << " of " << region.size()
+              << " bytes (seed " << options.seed << ")" << std::endl;
+
+    std::for_each(std::execution::par_unseq, chunks.begin(), chunks.end(),
+                  [&](std::string_view chunk) {
+                    process_chunk<TRACK_CHUNKS>(chunk, options.scan, *aggregate);
+                  });
+  } else if (options.deadline > 0) {
+    covered = scan_until(std::move(chunks),
+                         started + std::chrono::milliseconds(options.deadline),
+                         options.seed, options.scan, *aggregate);
+    std::cerr << "Covered " << covered << " of " << region.size()
+              << " bytes" << std::endl;
+  } else if (options.progress_interval > 0) {
+    scan_progressive(std::move(chunks),
+                     std::chrono::milliseconds(options.progress_interval),
+                     options.seed, options.scan, *aggregate);
+  } else if (options.outliers > 0) {
+    // Means and deviations first, then the rows beyond them
+    constexpr unsigned TWO_PASS = TRACK_VARIANCE | TRACK_IDS;
+    std::vector<ChunkIds> ids(chunks.size());
+    if (options.locate_extremes)
+      scan_exact<TWO_PASS | TRACK_EXTREMES>(chunks, options.scan, *aggregate,
+                                            ids);
+    else
+      scan_exact<TWO_PASS>(chunks, options.scan, *aggregate, ids);
+    count_outliers(chunks, ids, options.scan, options.outliers,
+                   aggregate->stations);
+  } else {
+    std::vector<ChunkIds> ids;
+    if (options.locate_extremes)
+      scan_exact<TRACK_EXTREMES>(chunks, options.scan, *aggregate, ids);
+    else
+      scan_exact<0>(chunks, options.scan, *aggregate, ids);
+  }
+
+  if (!report_problems(*aggregate, file, options.scan))
+    return 1;
+
+  if (options.sample < 1.0 || covered < region.size()) {
+    print_sampled_results(aggregate->stations,
+                          static_cast<double>(covered) /
+                              std::max<size_t>(region.size(), 1),
+                          options.scan.scale);
+  } else {
+    std::ostringstream out;
+    if (options.partial) {
+      print_partial(aggregate->stations, options.scan.scale, out);
+    } else {
+      const Annotations annotations{
+          metadata ? &*metadata : nullptr,
+          options.locate_extremes ? &file : nullptr,
+          options.locate_extremes ? &aggregate->stations : nullptr};
+      auto stations = aggregate->stations.sorted();
+      if (metadata)
+        stations = filter_stations(stations, *metadata, options);
+      if (!options.group_by.empty())
+        print_grouped_results(stations, annotations, options, out);
+      else
+        print_results(stations, options.scan.scale, out, annotations);
+      print_rollups(stations, options, annotations.metadata, out);
+      if (options.outliers > 0)
+        print_outliers(stations, aggregate->stations, options.outliers, out);
+      // Of the stations printed, --where leaves out the others
+      const uint64_t checksum = results_checksum(stations, options.scan.scale);
+      if (options.checksum)
+        out << "Checksum: " << std::hex << std::setw(16) << std::setfill('0')
+            << checksum << std::endl;
+    }
+    std::cout << out.str() << std::flush;
+    // Skipped rows would go unreported on a cache hit
+    if (cache && aggregate->malformed_rows.count() == 0)
+      cache->store(out.str());
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const auto started = std::chrono::steady_clock::now();
+  Options options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::invalid_argument &e) {
+    std::cerr << "Error: " << e.what() << '\n' << USAGE << std::endl;
+    return 1;
+  }
+  // Results do not depend on the number of workers, which only matters for
+  // speed and for checking just that. The default arena is sized to the
+  // CPUs, so more workers need a larger one as well as a raised limit.
+  // Without TBB the parallel algorithms run on the calling thread and the
+  // option has no effect.
+#if __has_include(<tbb/global_control.h>) && __has_include(<tbb/task_arena.h>)
+  if (options.threads != 0) {
+    const tbb::global_control limit(
+        tbb::global_control::max_allowed_parallelism, options.threads);
+    tbb::task_arena workers(static_cast<int>(options.threads));
+    return workers.execute([&] { return run(options, started); });
+  }
+#endif
+  return run(options, started);
 }